@@ -1,7 +1,35 @@
-#include <Keypad.h>
+// C64 keyboard to serial
+//
+// The matrix is scanned from a timer interrupt, one row per tick; each
+// tick reads the row that the previous tick drove low, so the lines have
+// a whole tick to settle.  A key must read the same for kDebounceMs before
+// a press or release counts.  Characters go out when a key is pressed, and
+// the last key pressed repeats while it's held.  The interrupt only queues
+// characters in txBuf; loop() hands them to Serial as it has room, so a
+// slow serial port never holds up the scan.
+//
+// The keymap, the shifted characters and the key sequences below all live
+// in PROGMEM.
 
+#include <avr/pgmspace.h>
 #include "lut_shifted.h"
 
+// Keys that send more than one character have codes from SEQ_FIRST up in
+// the keymap, indexing keySeqs[], which holds what they send unshifted and
+// shifted.  The cursor keys send VT100 escapes so the host can edit the
+// line in place, and the function keys type BASIC commands.
+enum {
+  SEQ_FIRST = 0x80,
+  SEQ_CRSR_DOWN = SEQ_FIRST, // shifted: up
+  SEQ_CRSR_RIGHT,            // shifted: left
+  SEQ_HOME,                  // shifted: clear
+  SEQ_DELETE,                // shifted: insert
+  SEQ_F1,                    // shifted: F2
+  SEQ_F3,                    // shifted: F4
+  SEQ_F5,                    // shifted: F6
+  SEQ_F7                     // shifted: F8
+};
+
 #define COMMODORE '"'
 #define CONTROL   '\r' 
 #define KEY_0     '0'
@@ -22,20 +50,20 @@
 #define KEY_COLON     ':'
 #define KEY_COMMA     ','
 #define KEY_D         'd'
-#define KEY_DELETE    '\b'
-#define KEY_DOWNARROW 'c'
+#define KEY_DELETE    SEQ_DELETE
+#define KEY_DOWNARROW SEQ_CRSR_DOWN
 #define KEY_E         'e'
 #define KEY_ENTER     '\n'
 #define KEY_EQUAL     '='
 #define KEY_ESCAPE    'd'
 #define KEY_F         'f'
-#define KEY_F1        "run"
-#define KEY_F3        "list"
-#define KEY_F5        "run"
-#define KEY_F7        "run"
+#define KEY_F1        SEQ_F1
+#define KEY_F3        SEQ_F3
+#define KEY_F5        SEQ_F5
+#define KEY_F7        SEQ_F7
 #define KEY_G         'g'
 #define KEY_H         'h'
-#define KEY_HOME      '\r'
+#define KEY_HOME      SEQ_HOME
 #define KEY_I         'i'
 #define KEY_J         'j'
 #define KEY_K         'k'
@@ -45,12 +73,11 @@
 #define KEY_N         'n'
 #define KEY_O         'o'
 #define KEY_P         'p'
-#define KEY_PAGEDOWN  156
 #define KEY_PERIOD    '.'
 #define KEY_PLUS      '+'
 #define KEY_Q         'q'
 #define KEY_R         'r'
-#define KEY_RIGHTARROW 'j'
+#define KEY_RIGHTARROW SEQ_CRSR_RIGHT
 #define KEY_S         's'
 #define KEY_SEMICOLON ';'
 #define KEY_SLASH     '/'
@@ -67,69 +94,209 @@
 #define LEFT_SHIFT    '['
 #define RIGHT_SHIFT   'k'
 #define KEY_POUND     '#'
-#define KEY_UP        'l'
-#define KEY_LEFT      'm'
 #define KEY_STOP      0x03
 #define KEY_TAB       'o'
 
+// timing
+#define kScanHz         250  /* whole matrix scans per second, 62 or more */
+#define kDebounceMs     8
+#define kRepeatDelayMs  500  /* before a held key starts repeating */
+#define kRepeatRateMs   66   /* between repeats, ~15 per second */
+#define kTxBufSize      64   /* must be a power of 2 */
+
+#define msToScans(ms)   (((ms) * kScanHz + 999L) / 1000)
+
 const byte ROWS = 8;
 const byte COLS = 8;
 
-char keys_normal[ROWS][COLS] = {
+const byte keys_normal[ROWS][COLS] PROGMEM = {
  {KEY_1, KEY_BACKTICK, CONTROL, KEY_STOP, KEY_SPACE, COMMODORE, KEY_Q, KEY_2},
  {KEY_3, KEY_W, KEY_A, LEFT_SHIFT, KEY_Z, KEY_S, KEY_E, KEY_4},
  {KEY_5, KEY_R, KEY_D, KEY_X, KEY_C, KEY_F, KEY_T, KEY_6},
  {KEY_7, KEY_Y, KEY_G, KEY_V, KEY_B, KEY_H, KEY_U, KEY_8},
  {KEY_9, KEY_I, KEY_J, KEY_N, KEY_M, KEY_K, KEY_O, KEY_0},
  {KEY_PLUS, KEY_P, KEY_L, KEY_COMMA, KEY_PERIOD, KEY_COLON, KEY_AT, KEY_MINUS},
- {KEY_PAGEDOWN, KEY_STAR, KEY_SEMICOLON, KEY_HOME, RIGHT_SHIFT, KEY_EQUAL, KEY_BACKSLASH, KEY_SLASH},
+ {KEY_POUND, KEY_STAR, KEY_SEMICOLON, KEY_HOME, RIGHT_SHIFT, KEY_EQUAL, KEY_BACKSLASH, KEY_SLASH},
  {KEY_DELETE, KEY_ENTER, KEY_RIGHTARROW, KEY_DOWNARROW, KEY_F1, KEY_F3, KEY_F5, KEY_F7}
 };
 
+const char seqDown[]   PROGMEM = "\033[B";
+const char seqUp[]     PROGMEM = "\033[A";
+const char seqRight[]  PROGMEM = "\033[C";
+const char seqLeft[]   PROGMEM = "\033[D";
+const char seqHome[]   PROGMEM = "\033[H";
+const char seqClear[]  PROGMEM = "\033[H\033[2J";
+const char seqDelete[] PROGMEM = "\b";
+const char seqInsert[] PROGMEM = "\033[@";
+const char seqF1[]     PROGMEM = "RUN\r";
+const char seqF2[]     PROGMEM = "\033OP";
+const char seqF3[]     PROGMEM = "LIST\r";
+const char seqF4[]     PROGMEM = "\033OQ";
+const char seqF5[]     PROGMEM = "LOAD ";
+const char seqF6[]     PROGMEM = "\033OR";
+const char seqF7[]     PROGMEM = "SAVE ";
+const char seqF8[]     PROGMEM = "\033OS";
+
+struct keySeq {
+  const char *normal;
+  const char *shifted;
+};
+
+const keySeq keySeqs[] PROGMEM = {
+  { seqDown,   seqUp     }, // SEQ_CRSR_DOWN
+  { seqRight,  seqLeft   }, // SEQ_CRSR_RIGHT
+  { seqHome,   seqClear  }, // SEQ_HOME
+  { seqDelete, seqInsert }, // SEQ_DELETE
+  { seqF1,     seqF2     }, // SEQ_F1
+  { seqF3,     seqF4     }, // SEQ_F3
+  { seqF5,     seqF6     }, // SEQ_F5
+  { seqF7,     seqF8     }  // SEQ_F7
+};
+
+// the shift keys, by position ('k' is also KEY_K)
+#define LSHIFT_ROW 1
+#define LSHIFT_COL 3
+#define RSHIFT_ROW 6
+#define RSHIFT_COL 4
+
 byte colPins[COLS] = {10,11,12,14,15,16,17,18};
 byte rowPins[ROWS] = {2,3,4,5,6,7,8,9};
 
-Keypad kp_normal( makeKeymap(keys_normal), rowPins, colPins, sizeof(rowPins), sizeof(colPins) );
+static_assert(F_CPU / 128 / (kScanHz * ROWS) <= 256, "kScanHz too low for timer 2");
 
-bool shifted = false;
+// debounced key state, a bit per column
+byte keyDown[ROWS];
+// scans in a row that each key has read differently from keyDown
+byte keyCount[ROWS][COLS];
+// row driven low, to be read on the next tick
+byte scanRow = 0;
 
-char to_shifted(char ch){
-  return lut_shifted[ch];
+#define NO_KEY 0xff
+byte repeatKey = NO_KEY;    // row * COLS + col
+unsigned int repeatScans;   // until it next repeats
+
+volatile byte txBuf[kTxBufSize];
+volatile byte txHead = 0;   // written by the interrupt
+volatile byte txTail = 0;   // written by loop()
+
+byte to_shifted(byte ch){
+  if (ch >= sizeof(lut_shifted)) return ch;
+  return pgm_read_byte(&lut_shifted[ch]);
+}
+
+bool shifted(){
+  return (keyDown[LSHIFT_ROW] & bit(LSHIFT_COL)) || (keyDown[RSHIFT_ROW] & bit(RSHIFT_COL));
+}
+
+bool isShift(byte r, byte c){
+  return (r == LSHIFT_ROW && c == LSHIFT_COL) || (r == RSHIFT_ROW && c == RSHIFT_COL);
+}
+
+// queue a character for loop() to send. if it's full the character is lost,
+// but at 9600 baud it empties faster than anyone can type
+void txPut(byte b){
+  if ((byte)(txHead - txTail) < kTxBufSize){
+    txBuf[txHead & (kTxBufSize - 1)] = b;
+    txHead++;
+  }
+}
+
+// queue a sequence from PROGMEM, all of it or none, so an escape sequence
+// is never cut short
+void txPutSeq(const char *s){
+  byte len = strlen_P(s);
+
+  if (kTxBufSize - (byte)(txHead - txTail) < len) return;
+  while (len--){
+    txBuf[txHead & (kTxBufSize - 1)] = pgm_read_byte(s++);
+    txHead++;
+  }
+}
+
+void sendKey(byte key){
+  byte code = pgm_read_byte(&keys_normal[key / COLS][key % COLS]);
+  bool shift = shifted();
+
+  if (code >= SEQ_FIRST){
+    const keySeq *k = &keySeqs[code - SEQ_FIRST];
+    txPutSeq((const char *)pgm_read_word(shift ? &k->shifted : &k->normal));
+  } else {
+    txPut(shift ? to_shifted(code) : code);
+  }
+}
+
+void keyChanged(byte r, byte c, bool down){
+  byte key = r * COLS + c;
+
+  if (isShift(r, c)) return;
+
+  if (down){
+    sendKey(key);
+    repeatKey = key;
+    repeatScans = msToScans(kRepeatDelayMs);
+  } else if (key == repeatKey){
+    repeatKey = NO_KEY;
+  }
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+    byte r = scanRow;
+
+    for (byte c = 0; c < COLS; c++){
+        bool down = digitalRead(colPins[c]) == LOW;
+        bool was = keyDown[r] & bit(c);
+
+        if (down == was){
+            keyCount[r][c] = 0;
+        } else if (++keyCount[r][c] >= msToScans(kDebounceMs)){
+            keyCount[r][c] = 0;
+            keyDown[r] ^= bit(c);
+            keyChanged(r, c, down);
+        }
+    }
+
+    // release this row and drive the next one
+    pinMode(rowPins[r], INPUT);
+    r = (r + 1) % ROWS;
+    digitalWrite(rowPins[r], LOW);
+    pinMode(rowPins[r], OUTPUT);
+    scanRow = r;
+
+    // typematic repeat, once per scan
+    if (r == 0 && repeatKey != NO_KEY && --repeatScans == 0){
+        sendKey(repeatKey);
+        repeatScans = msToScans(kRepeatRateMs);
+    }
 }
 
 void setup()
 {
     Serial.begin(9600);
+
+    for (byte c = 0; c < COLS; c++){
+        pinMode(colPins[c], INPUT_PULLUP);
+    }
+    for (byte r = 0; r < ROWS; r++){
+        pinMode(rowPins[r], INPUT);
+    }
+    digitalWrite(rowPins[0], LOW);
+    pinMode(rowPins[0], OUTPUT);
+
+    // timer 2 in CTC mode, clk/128, interrupting ROWS times per scan
+    noInterrupts();
+    TCCR2A = bit(WGM21);
+    TCCR2B = bit(CS22) | bit(CS20);
+    OCR2A = F_CPU / 128 / (kScanHz * ROWS) - 1;
+    TCNT2 = 0;
+    TIMSK2 = bit(OCIE2A);
+    interrupts();
 }
 
 void loop()
 {
-    if (kp_normal.getKeys()){
-        for (int i=0; i<LIST_MAX; i++){
-            if ( kp_normal.key[i].stateChanged ){
-                switch (kp_normal.key[i].kstate){
-                    case PRESSED:
-                      if (kp_normal.key[i].kchar == LEFT_SHIFT){
-                        shifted = true;
-                      }
-                      break;
-                    case RELEASED:
-                      if (kp_normal.key[i].kchar == LEFT_SHIFT){
-                        shifted = false;  
-                      } else { 
-                        if(!shifted){              
-                          Serial.print(kp_normal.key[i].kchar);  
-                        } else {
-                          Serial.print(to_shifted(kp_normal.key[i].kchar));;
-                        }
-                      }
-                      break;
-                    case HOLD:
-                      break;
-                    case IDLE:
-                      break;
-                }
-            }
-        }
-    } 
+    while (txTail != txHead && Serial.availableForWrite() > 0){
+        Serial.write(txBuf[txTail & (kTxBufSize - 1)]);
+        txTail++;
+    }
 }
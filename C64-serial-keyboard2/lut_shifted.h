@@ -1,4 +1,4 @@
-char lut_shifted[] = {
+const char lut_shifted[] PROGMEM = {
        // Char  Dec  Oct  Hex 
        // -------------------
   '.', // (nul)   0 0000 0x00 
@@ -37,8 +37,12 @@
  http://www.arduino.cc/en/Tutorial/LiquidCrystalSerialDisplay
 
 */
-int screenMem[80];
+// What should be on the LCD, and what the LCD is showing now. Row 3 is the input line.
+byte screenMem[4][20];
+byte lcdShadow[4][20];
 int cursorX = 0;
+// Where the LCD's address counter points, so neighbouring cells don't need a setCursor
+int lcdAddrRow = 0, lcdAddrCol = 0;
 // include the library code:
 #include <LiquidCrystal.h>
 
@@ -54,8 +58,7 @@ static void lcdChar(byte c) {
     if (cursorX > 0) {
   
       cursorX -= 1; //Go back one
-      screenMem[60 + cursorX] = 32; //Erase it from memory
-      doFrame(60 + cursorX); //Redraw screen up to that amount
+      screenMem[3][cursorX] = 32; //Erase it from memory
       
     }
   
@@ -63,63 +66,80 @@ static void lcdChar(byte c) {
 
   if (c != 13 and c != 10 and c != 8) { // Not a backspace or return, just a normal character
   
-    screenMem[60 + cursorX] = c;
+    screenMem[3][cursorX] = c;
     cursorX += 1;
-    if (cursorX < 20) {
-    
-      lcd.write(c);
-    
-    }
     
   }
   
   if (cursorX == 20 or c == 10) { // Did we hit Enter or go type past the end of a visible line?
   
-    // Lines are interlaced as described here: http://www.element14.com/community/message/81507/l/re-basic-pocket-computer-display-modification#81507
+    // Scroll up, blank input line at the bottom
     for (int xg = 0 ; xg < 20 ; xg++) {
 
-      screenMem[0 + xg] = screenMem[40 + xg];
-      screenMem[40 + xg] = screenMem[20 + xg];    
-      screenMem[20 + xg] = screenMem[60 + xg];
-      screenMem[60 + xg] = 32;
-    
+      screenMem[0][xg] = screenMem[1][xg];
+      screenMem[1][xg] = screenMem[2][xg];
+      screenMem[2][xg] = screenMem[3][xg];
+      screenMem[3][xg] = 32;
     
     }
   
     cursorX = 0;
-    
-    doFrame(60);  
 
   }
 
 
 }
 
-static void doFrame(byte amount) {
+// Bring the LCD up to date with screenMem, writing only the cells that changed.
+// setCursor() takes care of the interlaced row addresses (row 1 follows row 0 at
+// 0x40, rows 2 and 3 follow rows 0 and 1 at +20), so each row is addressed by number.
+static void lcdUpdate() {
 
-  lcd.clear();
-  lcd.noCursor();
-    
-  for (int xg = 0 ; xg < amount ; xg++) {
+  for (int yg = 0 ; yg < 4 ; yg++) {
   
-    lcd.write(screenMem[xg]);
+    for (int xg = 0 ; xg < 20 ; xg++) {
+    
+      if (lcdShadow[yg][xg] != screenMem[yg][xg]) {
+      
+        if (lcdAddrRow != yg or lcdAddrCol != xg) {
+          lcd.setCursor(xg, yg);
+        }
+        lcd.write(screenMem[yg][xg]);
+        lcdShadow[yg][xg] = screenMem[yg][xg];
+        lcdAddrRow = yg;
+        lcdAddrCol = xg + 1; // The LCD moves on after each write
+        
+      }
+      
+    }
+    
   }
 
-  lcd.cursor();
+  // Put the blinking cursor back on the input line
+  if (lcdAddrRow != 3 or lcdAddrCol != cursorX) {
+    lcd.setCursor(cursorX, 3);
+    lcdAddrRow = 3;
+    lcdAddrCol = cursorX;
+  }
 
 }
 
 void setup() {
 Serial.begin(9600); // opens serial port
-    lcd.begin(20, 4);
+    lcd.begin(20, 4); // also clears the LCD
 
-  for (int xg = 0 ; xg < 80 ; xg++) {
-    screenMem[xg] = 32;
+  for (int yg = 0 ; yg < 4 ; yg++) {
+    for (int xg = 0 ; xg < 20 ; xg++) {
+      screenMem[yg][xg] = 32;
+      lcdShadow[yg][xg] = 32;
+    }
   }
 
+  lcd.cursor();
   lcd.blink();
-  
-  doFrame(80);
+  lcd.setCursor(0, 3);
+  lcdAddrRow = 3;
+  lcdAddrCol = 0;
 }
 
 void loop() {
@@ -132,5 +152,7 @@ void loop() {
       // display each character to the LCD
       lcdChar(Serial.read());
     }
+    // then show the result in one pass
+    lcdUpdate();
   }
 }
@@ -36,13 +36,27 @@
  *  - PINMODE <pin>, <mode> - sets the pin mode (0=input, 1=output, 2=pullup)
  *  - PIN <pin>, <state> - sets the pin high (non zero) or low (zero)
  *  - PINREAD(pin) returns pin value, ANALOGRD(pin) for analog pins
+ *  - DATA items are numbers or quoted strings. READ takes them in program
+ *     order, RESTORE starts again from the beginning and RESTORE n from the
+ *     first DATA statement at or after line n.
+ *  - ABS, SQR, SIN, COS, ATN, EXP and LOG work in radians.
+ *  - ON PIN n RISING|FALLING|CHANGE GOSUB line runs line as a subroutine
+ *     when that edge arrives on pin n, in between the program's own
+ *     statements. ON PIN n OFF stops it. PINLOST(n) counts the edges lost
+ *     because too many were waiting. Pin n is bit n % 16 of port A, B or C.
+ *  - ON TIMER ms GOSUB line runs line every ms milliseconds, the same way.
+ *     Each handler line has its own timer; ON TIMER 0 GOSUB line stops one
+ *     and ON TIMER OFF stops them all.
+ *  - SAMPLE pin, array, count, rate reads an analog pin rate times a second
+ *     into the first count elements of a numeric array, in the background.
+ *     SAMPLED is how many have arrived so far, or -1 if some were lost.
+ *  - PORTOUT port, mask, value sets the pins of a whole port at once, and
+ *     PORTIN(port) reads them. Port 0 is A, 1 is B and 2 is C, 16 pins
+ *     each. SHIFTOUT dataPin, clockPin, bitOrder, array, count clocks out
+ *     the first count elements of an array as bytes.
  * ---------------------------------------------------------------------------
  */
 
-/* TODO
-   ABS, SIN, COS, EXP etc
-   DATA, READ, RESTORE */
-
 /* Modified by VS for Stm32Basic project (2018) */
 
 #include <stdio.h>
@@ -86,6 +100,7 @@ const char string_21[] = "Bad array index";
 const char string_22[] = "Bad string index";
 const char string_23[] = "Error in VAL input";
 const char string_24[] = "Bad parameter";
+const char string_25[] = "Out of DATA";
 
 const char* errorTable[] =
 {
@@ -95,7 +110,7 @@ const char* errorTable[] =
     string_12, string_13, string_14, string_15,
     string_16, string_17, string_18, string_19,
     string_20, string_21, string_22, string_23,
-    string_24
+    string_24, string_25
 };
 
 /* Token flags
@@ -130,12 +145,18 @@ const TokenTableEntry tokenTable[] =
     {"IF",TKN_FMT_POST}, {"THEN",TKN_FMT_PRE|TKN_FMT_POST}, {"LEN",1|TKN_ARG1_TYPE_STR},
     {"VAL",1|TKN_ARG1_TYPE_STR}, {"RND",0}, {"INT",1}, {"STR$", 1|TKN_RET_TYPE_STR},
     {"FOR",TKN_FMT_POST}, {"TO",TKN_FMT_PRE|TKN_FMT_POST}, {"STEP",TKN_FMT_PRE|TKN_FMT_POST},
-    {"NEXT", TKN_FMT_POST}, {"MOD",TKN_FMT_PRE|TKN_FMT_POST}, {"NEW",TKN_FMT_POST},{"GOSUB",TKN_FMT_POST},
+    {"NEXT", TKN_FMT_POST}, {"MOD",TKN_FMT_PRE|TKN_FMT_POST}, {"NEW",TKN_FMT_POST},{"GOSUB",TKN_FMT_PRE|TKN_FMT_POST},
     {"RETURN",TKN_FMT_POST}, {"DIM", TKN_FMT_POST}, {"LEFT$",2|TKN_ARG1_TYPE_STR|TKN_RET_TYPE_STR},
     {"RIGHT$",2|TKN_ARG1_TYPE_STR|TKN_RET_TYPE_STR}, {"MID$",3|TKN_ARG1_TYPE_STR|TKN_RET_TYPE_STR},
     {"CLS",TKN_FMT_POST}, {"PAUSE",TKN_FMT_POST}, {"POSITION", TKN_FMT_POST},  {"PIN",TKN_FMT_POST},
     {"PINMODE", TKN_FMT_POST}, {"INKEY$", 0}, {"SAVE", TKN_FMT_POST}, {"LOAD", TKN_FMT_POST},
-    {"PINREAD",1}, {"ANALOGRD",1}, {"DIR", TKN_FMT_POST}, {"DELETE", TKN_FMT_POST}
+    {"PINREAD",1}, {"ANALOGRD",1}, {"DIR", TKN_FMT_POST}, {"DELETE", TKN_FMT_POST},
+    {"DATA", TKN_FMT_POST}, {"READ", TKN_FMT_POST}, {"RESTORE", TKN_FMT_POST},
+    {"ABS",1}, {"SQR",1}, {"SIN",1}, {"COS",1}, {"ATN",1}, {"EXP",1}, {"LOG",1},
+    {"ON",TKN_FMT_POST}, {"RISING",TKN_FMT_PRE|TKN_FMT_POST}, {"FALLING",TKN_FMT_PRE|TKN_FMT_POST},
+    {"CHANGE",TKN_FMT_PRE|TKN_FMT_POST}, {"OFF",TKN_FMT_PRE}, {"PINLOST",1}, {"TIMER",TKN_FMT_POST},
+    {"SAMPLE",TKN_FMT_POST}, {"SAMPLED",0}, {"PORTOUT",TKN_FMT_POST}, {"PORTIN",1},
+    {"SHIFTOUT",TKN_FMT_POST}
 };
 
 
@@ -145,9 +166,13 @@ const TokenTableEntry tokenTable[] =
 void print_tokens(uint8_t *p)
 {
     int32_t modeREM = 0;
+    int32_t spaced = 1;     /* The last thing printed was a space, so a TKN_FMT_PRE one isn't needed */
 
     while (*p != TOKEN_EOL)
     {
+        int32_t wasSpaced = spaced;
+
+        spaced = 0;
         if (*p == TOKEN_IDENT)
         {
             p++;
@@ -199,7 +224,7 @@ void print_tokens(uint8_t *p)
         {
             uint8_t fmt = *(&tokenTable[*p].format);
 
-            if (fmt & TKN_FMT_PRE)
+            if ((fmt & TKN_FMT_PRE) && !wasSpaced)
             {
                 host_output_char(' ');
             }
@@ -209,6 +234,7 @@ void print_tokens(uint8_t *p)
             if (fmt & TKN_FMT_POST)
             {
                 host_output_char(' ');
+                spaced = 1;
             }
 
             if (*p == TOKEN_REM)
@@ -286,6 +312,7 @@ int32_t do_prog_line(uint16_t lineNum, uint8_t* tokenPtr, int32_t tokensLength)
     /* Now check to see if this is an empty line, if so don't insert it */
     if (*tokenPtr == TOKEN_EOL)
     {
+        restore_data(&mem[0]);
         return 1;
     }
 
@@ -308,6 +335,7 @@ int32_t do_prog_line(uint16_t lineNum, uint8_t* tokenPtr, int32_t tokensLength)
     p += 2;
     memcpy(p, tokenPtr, tokensLength);
     sysPROGEND += bytesNeeded;
+    restore_data(&mem[0]);
     return 1;
 }
 
@@ -483,6 +511,11 @@ void stack_mid_str(int32_t start, int32_t len)
    | len    | type  | name            | num dims | dim1  |      | dimN  | elem(1,..1) |
    | 2bytes | 1byte | null terminated | 2bytes   | 2bytes|      | 2bytes| float       |
    +--------+-------+-----------------+----------+-------+ . . .+-------+-------------+. .
+
+   String arrays have a table of numElements+1 offsets (2 bytes each, counted
+   from the start of the table) after the dims, followed by the strings.
+   Element n lives between table[n] and table[n+1], so it can be found without
+   scanning and rewritten in place if the new value fits.
 */
 
 /* Variable type byte */
@@ -513,10 +546,53 @@ uint8_t *find_variable(char *searchName, int32_t searchMask)
     return NULL;
 }
 
+/* Array elements are the hot path in most programs, so the last few arrays
+   used are remembered rather than searched for in the variable table each
+   time. Anything that moves existing variables must invalidate the cache. */
+#define ARRAY_CACHE_SIZE                        4
+
+static struct
+{
+    char name[MAX_IDENT_LEN + 1];
+    uint8_t *var;
+} arrayCache[ARRAY_CACHE_SIZE];
+static uint8_t arrayCacheNext;
+
+void invalidate_array_cache(void)
+{
+    for (int32_t i = 0; i < ARRAY_CACHE_SIZE; i++)
+    {
+        arrayCache[i].name[0] = 0;
+    }
+}
+
+uint8_t *find_array(char *name, int32_t type)
+{
+    for (int32_t i = 0; i < ARRAY_CACHE_SIZE; i++)
+    {
+        if (strcasecmp(arrayCache[i].name, name) == 0)
+        {
+            return arrayCache[i].var;
+        }
+    }
+
+    uint8_t *p = find_variable(name, type);
+    if (p != NULL)
+    {
+        strcpy(arrayCache[arrayCacheNext].name, name);
+        arrayCache[arrayCacheNext].var = p;
+        arrayCacheNext = (arrayCacheNext + 1) % ARRAY_CACHE_SIZE;
+    }
+
+    return p;
+}
+
 void delete_variable_at(uint8_t *pos)
 {
     int32_t len = *(uint16_t *)pos;
 
+    invalidate_array_cache();
+
     if (pos == &mem[sysVARSTART])
     {
         sysVARSTART += len;
@@ -687,7 +763,15 @@ int32_t create_array(char *name, int32_t isString)
         numElements *= dim;
     }
 
-    bytesNeeded += 2 * numDims + (isString ? 1 : sizeof(float)) * numElements;
+    bytesNeeded += 2 * numDims;
+    if (isString)
+    {
+        bytesNeeded += 2 * (numElements + 1) + numElements;    /* Offset table + empty strings */
+    }
+    else
+    {
+        bytesNeeded += sizeof(float) * numElements;
+    }
 
     /* Strings and arrays are re-allocated if they already exist */
     uint8_t *p = find_variable(name, (isString ? VAR_TYPE_STR_ARRAY : VAR_TYPE_NUM_ARRAY));
@@ -729,176 +813,91 @@ int32_t create_array(char *name, int32_t isString)
         p += 2;
     }
 
-    memset(p, 0, numElements * (isString ? 1 : sizeof(float)));
-    return 1;
-}
-
-int32_t get_array_elem_offset(uint8_t **p, int32_t *pOffset)
-{
-    /* Check for correct dimensionality */
-    int32_t numArrayDims = *(uint16_t*)*p;
-    *p += 2;
-    int32_t numDimsGiven = (int32_t)stack_pop_num();
-
-    if (numArrayDims != numDimsGiven)
-    {
-        return ERROR_WRONG_ARRAY_DIMENSIONS;
-    }
-
-    /* Now lookup the element */
-    int32_t offset = 0;
-    int32_t base = 1;
-    for (int32_t i = 0; i < numArrayDims; i++)
+    if (isString)
     {
-        int32_t index = (int32_t)stack_pop_num();
-        int32_t arrayDim = *(uint16_t*)*p;
-        *p += 2;
+        uint16_t *table = (uint16_t *)p;
+        int32_t strStart = 2 * (numElements + 1);
 
-        if (index < 1 || index > arrayDim)
+        for (i = 0; i <= numElements; i++)
         {
-            return ERROR_ARRAY_SUBSCRIPT_OUT_RANGE;
+            table[i] = strStart + i;
         }
 
-        offset += base * (index - 1);
-        base *= arrayDim;
+        p += strStart;
     }
 
-    *pOffset = offset;
-    return 0;
+    memset(p, 0, numElements * (isString ? 1 : sizeof(float)));
+    return 1;
 }
 
-int32_t set_num_array_elem(char *name, float val)
-{
-    /* Each index and number of dimensions on the calculator stack */
-    uint8_t *p = find_variable(name, VAR_TYPE_NUM_ARRAY);
-
-    if (p == NULL)
-    {
-        return ERROR_VARIABLE_NOT_FOUND;
-    }
-
-    p += 3 + strlen(name) + 1;
-
-    int32_t offset;
-    int32_t ret = get_array_elem_offset(&p, &offset);
-    if (ret)
-    {
-        return ret;
-    }
+/* The element functions take the array's elements (or offset table, for
+   string arrays) and the element offset, as found by parse_array_element() */
 
-    p += sizeof(float)*offset;
-    *(float *)p = val;
-    return ERROR_NONE;
+void set_num_array_elem(uint8_t *elems, int32_t offset, float val)
+{
+    *(float *)(elems + sizeof(float) * offset) = val;
 }
 
-int32_t set_str_array_elem(char *name)
+int32_t set_str_array_elem(uint8_t *var, uint8_t *elems, int32_t offset, char *val)
 {
-    /* String is top of the stack
-       each index and number of dimensions on the calculator stack */
-
-    /* Keep the current stack position, since we can't overwrite the value string */
-    int32_t oldSTACKEND = sysSTACKEND;
-
-    /* How long is the new value? */
-    char *newValPtr = stack_pop_str();
-    int32_t newValLen = strlen(newValPtr);
-
-    uint8_t *p = find_variable(name, VAR_TYPE_STR_ARRAY);
-    uint8_t *p1 = p;    /* So we can correct the length when done */
-    if (p == NULL)
-    {
-        return ERROR_VARIABLE_NOT_FOUND;
-    }
-
-    p += 3 + strlen(name) + 1;
+    uint16_t *table = (uint16_t *)elems;
+    uint8_t *elem = elems + table[offset];
+    int32_t bytesNeeded = (int32_t)strlen(val) + 1 - (table[offset + 1] - table[offset]);
 
-    int32_t offset;
-    int32_t ret = get_array_elem_offset(&p, &offset);
-    if (ret)
+    if (bytesNeeded > 0)
     {
-        return ret;
-    }
+        /* Check if we've got enough room for the new value */
+        if (sysVARSTART - bytesNeeded < sysSTACKEND)
+        {
+            return ERROR_OUT_OF_MEMORY;
+        }
 
-    /* Find the correct element by skipping over null terminators */
-    int32_t i = 0;
-    while (i < offset)
-    {
-        if (*p == 0) i++;
-        p++;
-    }
+        /* Correct the length of the variable */
+        *(uint16_t*)var += bytesNeeded;
 
-    int32_t oldValLen = strlen((char*)p);
-    int32_t bytesNeeded = newValLen - oldValLen;
+        /* Grow the slot downwards - everything before it moves, so the
+           offsets of the elements after it increase */
+        memmove(&mem[sysVARSTART - bytesNeeded], &mem[sysVARSTART], elem - &mem[sysVARSTART]);
+        sysVARSTART -= bytesNeeded;
+        invalidate_array_cache();
+        elem -= bytesNeeded;
+        table = (uint16_t *)((uint8_t *)table - bytesNeeded);
 
-    /* Check if we've got enough room for the new value */
-    if (sysVARSTART - bytesNeeded < oldSTACKEND)
-    {
-        return 0;       /* Out of memory */
+        int32_t numElements = (table[0] >> 1) - 1;
+        for (int32_t i = offset + 1; i <= numElements; i++)
+        {
+            table[i] += bytesNeeded;
+        }
     }
 
-    /* Correct the length of the variable */
-    *(uint16_t*)p1 += bytesNeeded;
-    memmove(&mem[sysVARSTART - bytesNeeded], &mem[sysVARSTART], p - &mem[sysVARSTART]);
-
     /* Copy in the new value */
-    strcpy((char*)(p - bytesNeeded), newValPtr);
-    sysVARSTART -= bytesNeeded;
+    strcpy((char*)elem, val);
     return ERROR_NONE;
 }
 
-float lookup_num_array_elem(char *name, int32_t *error)
+float lookup_num_array_elem(uint8_t *elems, int32_t offset)
 {
-    // each index and number of dimensions on the calculator stack
-    uint8_t *p = find_variable(name, VAR_TYPE_NUM_ARRAY);
-    if (p == NULL)
-    {
-        *error = ERROR_VARIABLE_NOT_FOUND;
-        return 0.0f;
-    }
-
-    p += 3 + strlen(name) + 1;
-
-    int32_t offset;
-    int32_t ret = get_array_elem_offset(&p, &offset);
-    if (ret)
-    {
-        *error = ret;
-        return 0.0f;
-    }
-
-    p += sizeof(float)*offset;
-    return *(float *)p;
+    return *(float *)(elems + sizeof(float) * offset);
 }
 
-char *lookup_str_array_elem(char *name, int32_t *error)
+char *lookup_str_array_elem(uint8_t *elems, int32_t offset)
 {
-    /* Each index and number of dimensions on the calculator stack */
-    uint8_t *p = find_variable(name, VAR_TYPE_STR_ARRAY);
-    if (p == NULL)
-    {
-        *error = ERROR_VARIABLE_NOT_FOUND;
-        return NULL;
-    }
-
-    p += 3 + strlen(name) + 1;
+    return (char *)elems + ((uint16_t *)elems)[offset];
+}
 
-    int32_t offset;
-    int32_t ret = get_array_elem_offset(&p, &offset);
-    if (ret)
-    {
-        *error = ret;
-        return NULL;
-    }
+/* The elements of the numeric array var, and how many there are */
+float *num_array_elems(uint8_t *var, char *name, int32_t *numElements)
+{
+    uint16_t *dims = (uint16_t *)(var + 3 + strlen(name) + 1);
+    int32_t i, numDims = *dims++;
 
-    /* Find the correct element by skipping over null terminators */
-    int32_t i = 0;
-    while (i < offset)
+    *numElements = 1;
+    for (i = 0; i < numDims; i++)
     {
-        if (*p == 0) i++;
-        p++;
+        *numElements *= dims[i];
     }
 
-    return (char *)p;
+    return (float *)(dims + numDims);
 }
 
 float lookup_num_variable(char *name)
@@ -968,6 +967,7 @@ int32_t gosub_stack_push(int32_t lineNum,int32_t stmtNumber)
 
     /* Shift the variable table */
     memmove(&mem[sysVARSTART] - bytesNeeded, &mem[sysVARSTART], sysVAREND - sysVARSTART);
+    invalidate_array_cache();
     sysVARSTART -= bytesNeeded;
     sysVAREND -= bytesNeeded;
 
@@ -993,6 +993,7 @@ int32_t gosub_stack_pop(int32_t *lineNum, int32_t *stmtNumber)
 
     /* Shift the variable table */
     memmove(&mem[sysVARSTART] + bytesFreed, &mem[sysVARSTART], sysVAREND - sysVARSTART);
+    invalidate_array_cache();
     sysVARSTART += bytesFreed;
     sysVAREND += bytesFreed;
     sysGOSUBSTART = sysVAREND;
@@ -1000,133 +1001,519 @@ int32_t gosub_stack_pop(int32_t *lineNum, int32_t *stmtNumber)
 }
 
 /* **************************************************************************
- * LEXER
+ * DATA POINTER
  * **************************************************************************/
 
-static uint8_t *tokenIn, *tokenOut;
-static int32_t tokenOutLeft;
+/* The lexer has already turned DATA items into binary constants, so READ
+   just needs a pointer to the next one: the line it's in, and where it is in
+   that line. The program is only searched when a DATA statement runs out. */
+static int32_t dataLine, dataPos;       /* dataPos 0 = search from the start of dataLine */
 
-/* next_token returns -1 for end of input, 0 for success, +ve number = error code */
-int32_t next_token(void)
+void restore_data(uint8_t *line)
 {
-    int32_t i;
+    dataLine = line - &mem[0];
+    dataPos = 0;
+}
 
-    /* Skip any whitespace */
-    while (isspace(*tokenIn))
+/* Skip a token and any value that follows it */
+uint8_t *skip_token(uint8_t *p)
+{
+    switch (*p++)
     {
-        tokenIn++;
+        case TOKEN_IDENT:
+            while (*p < 0x80)
+            {
+                p++;
+            }
+            return p + 1;
+
+        case TOKEN_NUMBER:
+            return p + sizeof(float);
+
+        case TOKEN_INTEGER:
+            return p + sizeof(long);
+
+        case TOKEN_STRING:
+            return p + strlen((char*)p) + 1;
+
+        default:
+            return p;
     }
+}
 
-    /* Check for end of line */
-    if (*tokenIn == 0)
+/* Find the next DATA item, or NULL if there are none left */
+uint8_t *find_data_item(void)
+{
+    uint8_t *line = &mem[dataLine];
+    uint8_t *p = &mem[dataPos];
+
+    if (dataPos)
     {
-        *tokenOut++ = TOKEN_EOL;
-        tokenOutLeft--;
-        return -1;
+        if (*p == TOKEN_COMMA)
+        {
+            return p + 1;
+        }
     }
-
-    /* Number: [0-9.]+ */
-    /* TODO - handle 1e4 etc */
-    if (isdigit(*tokenIn) || *tokenIn == '.')      /* Number: [0-9.]+ */
+    else
     {
-        int32_t gotDecimal = 0;
-        char numStr[MAX_NUMBER_LEN+1];
-        int32_t numLen = 0;
+        p = line + 4;
+    }
 
-        do
+    while (line < &mem[sysPROGEND])
+    {
+        while (*p != TOKEN_EOL)
         {
-            if (numLen == MAX_NUMBER_LEN)
+            if (*p == TOKEN_DATA)
             {
-                return ERROR_LEXER_BAD_NUM;
+                dataLine = line - &mem[0];
+                return p + 1;
             }
 
-            if (*tokenIn == '.')
-            {
-                if (gotDecimal)
-                {
-                    return ERROR_LEXER_BAD_NUM;
-                }
-                else
-                {
-                    gotDecimal = 1;
-                }
-            }
+            p = skip_token(p);
+        }
+
+        line += *(uint16_t *)line;
+        p = line + 4;
+    }
+
+    restore_data(&mem[sysPROGEND]);
+    return NULL;
+}
+
+/* Push the next DATA item onto the calculator stack */
+int32_t read_data(int32_t isString)
+{
+    uint8_t *p = find_data_item();
+    int32_t ok;
+
+    if (p == NULL)
+    {
+        return ERROR_OUT_OF_DATA;
+    }
 
-            numStr[numLen++] = *tokenIn++;
+    if (*p == TOKEN_STRING)
+    {
+        if (!isString)
+        {
+            return ERROR_EXPR_EXPECTED_NUM;
         }
-        while (isdigit(*tokenIn) || *tokenIn == '.');
 
-        numStr[numLen] = 0;
-        if (tokenOutLeft <= 5)
+        ok = stack_push_str((char*)p + 1);
+    }
+    else
+    {
+        float sign = 1.0f;
+        if (*p == TOKEN_MINUS)
         {
-            return ERROR_LEXER_TOO_LONG;
+            sign = -1.0f;
+            p++;
         }
 
-        tokenOutLeft -= 5;
-        if (!gotDecimal)
+        if (isString)
         {
-            long val = strtol(numStr, 0, 10);
-            if (val == LONG_MAX || val == LONG_MIN)
-            {
-                gotDecimal = 1; /* TODO True; */
-            }
-            else
-            {
-                *tokenOut++ = TOKEN_INTEGER;
-                *(long*)tokenOut = (long)val;
-                tokenOut += sizeof(long);
-            }
+            return ERROR_EXPR_EXPECTED_STR;
         }
 
-        if (gotDecimal)
+        if (*p == TOKEN_NUMBER)
         {
-            *tokenOut++ = TOKEN_NUMBER;
-            *(float*)tokenOut = (float)strtod(numStr, 0);
-            tokenOut += sizeof(float);
+            ok = stack_push_num(sign * *(float*)(p + 1));
+        }
+        else if (*p == TOKEN_INTEGER)
+        {
+            ok = stack_push_num(sign * (float)*(long*)(p + 1));
+        }
+        else
+        {
+            return ERROR_UNEXPECTED_TOKEN;
         }
+    }
 
-        return 0;
+    if (!ok)
+    {
+        return ERROR_OUT_OF_MEMORY;
     }
 
-    /* Identifier: [a-zA-Z][a-zA-Z0-9]*[$] */
-    if (isalpha(*tokenIn))
+    dataPos = skip_token(p) - &mem[0];
+    return 0;
+}
+
+/* **************************************************************************
+ * EVENTS
+ * **************************************************************************/
+
+/* The host queues the edges ON PIN asked for, from its interrupt, and ON TIMERs
+   fall due by host_millis(). process_input() checks for an event before each
+   line or jump, and runs the handler as a GOSUB from the statement it was
+   about to execute. Events wait while a handler is running, so handlers don't
+   nest. */
+static struct
+{
+    uint8_t pin;
+    uint16_t line;                      /* 0 = slot free */
+} pinHandlers[PIN_EVENT_SLOTS];
+static struct
+{
+    uint16_t line;                      /* 0 = slot free */
+    uint32_t period, due;               /* ms */
+} timers[EVENT_TIMERS];
+static int32_t eventGosubDepth;         /* Gosub stack depth inside the running handler */
+
+void clear_timers(void)
+{
+    int32_t i;
+
+    for (i = 0; i < EVENT_TIMERS; i++)
     {
-        char identStr[MAX_IDENT_LEN + 1];
-        int32_t identLen = 0;
-        identStr[identLen++] = *tokenIn++;  /* Copy first char */
+        timers[i].line = 0;
+    }
+}
 
-        while (isalnum(*tokenIn) || *tokenIn == '$')
-        {
-            if (identLen < MAX_IDENT_LEN)
-            {
-                identStr[identLen++] = *tokenIn;
-            }
+/* Period 0 stops the timer */
+int32_t set_timer(uint32_t period, uint16_t line)
+{
+    int32_t i, slot = -1;
 
-            tokenIn++;
+    for (i = 0; i < EVENT_TIMERS; i++)
+    {
+        if (timers[i].line == line)
+        {
+            slot = i;
+            break;
         }
 
-        identStr[identLen] = 0;
+        if (slot < 0 && !timers[i].line)
+        {
+            slot = i;
+        }
+    }
 
-        /* Check to see if this is a keyword */
-        for (i = FIRST_IDENT_TOKEN; i <= LAST_IDENT_TOKEN; i++)
+    if (!period)
+    {
+        if (slot >= 0 && timers[slot].line == line)
         {
-            if (strcasecmp(identStr, (char *)pgm_read_word(&tokenTable[i].token)) == 0)
-            {
-                if (tokenOutLeft <= 1)
-                {
-                    return ERROR_LEXER_TOO_LONG;
-                }
+            timers[slot].line = 0;
+        }
+        return 1;
+    }
 
-                tokenOutLeft--;
-                *tokenOut++ = i;
+    if (slot < 0)
+    {
+        return 0;
+    }
 
-                /* Special case for REM */
-                if (i == TOKEN_REM)
-                {
-                    *tokenOut++ = TOKEN_STRING;
+    timers[slot].line = line;
+    timers[slot].period = period;
+    timers[slot].due = host_millis() + period;
+    return 1;
+}
 
-                    /* Skip whitespace */
-                    while (isspace(*tokenIn))
+void clear_event_handlers(void)
+{
+    int32_t i;
+
+    for (i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (pinHandlers[i].line)
+        {
+            host_watch_pin(pinHandlers[i].pin, PIN_EVENT_OFF);
+            pinHandlers[i].line = 0;
+        }
+    }
+
+    while (host_get_pin_event() >= 0)
+    {
+    }
+
+    clear_timers();
+    eventGosubDepth = 0;
+}
+
+/* Line 0 removes the handler */
+int32_t set_pin_handler(int32_t pin, int32_t mode, uint16_t line)
+{
+    int32_t i, slot = -1;
+
+    for (i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (pinHandlers[i].line && pinHandlers[i].pin == pin)
+        {
+            slot = i;
+            break;
+        }
+
+        if (slot < 0 && !pinHandlers[i].line)
+        {
+            slot = i;
+        }
+    }
+
+    if (!line)
+    {
+        if (slot >= 0 && pinHandlers[slot].line && pinHandlers[slot].pin == pin)
+        {
+            host_watch_pin(pin, PIN_EVENT_OFF);
+            pinHandlers[slot].line = 0;
+        }
+        return 1;
+    }
+
+    if (slot < 0 || !host_watch_pin(pin, mode))
+    {
+        return 0;
+    }
+
+    pinHandlers[slot].pin = pin;
+    pinHandlers[slot].line = line;
+    return 1;
+}
+
+/* The handler line for the next event, or 0 if there isn't one to run now */
+uint16_t next_event_handler(void)
+{
+    int32_t i, pin;
+    uint32_t now;
+
+    if (eventGosubDepth)
+    {
+        if (sysGOSUBEND - sysGOSUBSTART >= eventGosubDepth)
+        {
+            return 0;           /* Still in the last handler */
+        }
+        eventGosubDepth = 0;
+    }
+
+    /* Timers first, since pin events keep in the queue */
+    now = host_millis();
+    for (i = 0; i < EVENT_TIMERS; i++)
+    {
+        if (timers[i].line && (int32_t)(now - timers[i].due) >= 0)
+        {
+            /* The next deadline is a whole number of periods on from this one,
+               so a late handler doesn't make the timer drift, and periods that
+               were missed altogether are skipped rather than run late */
+            uint32_t period = timers[i].period;
+            timers[i].due += ((now - timers[i].due) / period + 1) * period;
+            return timers[i].line;
+        }
+    }
+
+    while ((pin = host_get_pin_event()) >= 0)
+    {
+        for (i = 0; i < PIN_EVENT_SLOTS; i++)
+        {
+            if (pinHandlers[i].line && pinHandlers[i].pin == pin)
+            {
+                return pinHandlers[i].line;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* **************************************************************************
+ * SAMPLING
+ * **************************************************************************/
+
+/* SAMPLE has the host read the ADC in the background into a small queue, and
+   process_input() copies the readings into the array between lines. The
+   host can't write into the array itself, since GOSUB, DIM and string
+   assignments all move the variables about. */
+static char sampleArray[MAX_IDENT_LEN + 1];     /* "" = not sampling */
+static int32_t sampleCount, sampleStored;       /* sampleStored -1 = readings lost */
+
+void stop_sampling(void)
+{
+    if (sampleArray[0])
+    {
+        host_stop_sampling();
+    }
+
+    sampleArray[0] = 0;
+}
+
+int32_t start_sampling(int32_t pin, char *name, int32_t count, uint32_t rate)
+{
+    int32_t numElements;
+    uint8_t *var;
+
+    stop_sampling();
+    sampleStored = 0;
+
+    var = find_array(name, VAR_TYPE_NUM_ARRAY);
+    if (var == NULL)
+    {
+        return ERROR_VARIABLE_NOT_FOUND;
+    }
+
+    num_array_elems(var, name, &numElements);
+    if (count < 1 || count > numElements)
+    {
+        return ERROR_ARRAY_SUBSCRIPT_OUT_RANGE;
+    }
+
+    if (!host_start_sampling(pin, rate))
+    {
+        return ERROR_BAD_PARAMETER;
+    }
+
+    strcpy(sampleArray, name);
+    sampleCount = count;
+    return ERROR_NONE;
+}
+
+/* Copy the waiting readings into the array */
+void collect_samples(void)
+{
+    int32_t numElements = 0, reading;
+    float *elems = NULL;
+    uint8_t *var;
+
+    if (!sampleArray[0])
+    {
+        return;
+    }
+
+    var = find_array(sampleArray, VAR_TYPE_NUM_ARRAY);
+    if (var != NULL)
+    {
+        elems = num_array_elems(var, sampleArray, &numElements);
+    }
+
+    if (numElements < sampleCount)
+    {
+        /* The array was re-DIMmed smaller */
+        sampleStored = -1;
+        stop_sampling();
+        return;
+    }
+
+    while (sampleStored < sampleCount && (reading = host_get_sample()) >= 0)
+    {
+        elems[sampleStored++] = reading;
+    }
+
+    /* Checked after taking the readings, so one dropped while they were
+       being taken counts as well */
+    if (host_samples_lost())
+    {
+        /* A gap in the readings */
+        sampleStored = -1;
+        stop_sampling();
+    }
+    else if (sampleStored == sampleCount)
+    {
+        stop_sampling();
+    }
+}
+
+/* **************************************************************************
+ * LEXER
+ * **************************************************************************/
+
+static uint8_t *tokenIn, *tokenOut;
+static int32_t tokenOutLeft;
+
+/* next_token returns -1 for end of input, 0 for success, +ve number = error code */
+int32_t next_token(void)
+{
+    int32_t i;
+
+    /* Skip any whitespace */
+    while (isspace(*tokenIn))
+    {
+        tokenIn++;
+    }
+
+    /* Check for end of line */
+    if (*tokenIn == 0)
+    {
+        *tokenOut++ = TOKEN_EOL;
+        tokenOutLeft--;
+        return -1;
+    }
+
+    /* Number: [0-9]*[.][0-9]*, with an optional exponent e.g. 1.5e-3 */
+    if (isdigit(*tokenIn) || *tokenIn == '.')
+    {
+        const char *numEnd;
+        float f = host_str_to_float((char *)tokenIn, &numEnd);
+        unsigned long val = 0;
+        uint8_t *p = tokenIn;
+
+        if (numEnd == (char *)tokenIn || *numEnd == '.')
+        {
+            return ERROR_LEXER_BAD_NUM;
+        }
+
+        if (tokenOutLeft <= 5)
+        {
+            return ERROR_LEXER_TOO_LONG;
+        }
+
+        tokenOutLeft -= 5;
+        /* Keep plain integers exact, if they fit in a long */
+        while (isdigit(*p) && (val < LONG_MAX / 10 || (val == LONG_MAX / 10 && *p - '0' <= LONG_MAX % 10)))
+        {
+            val = val * 10 + (*p++ - '0');
+        }
+
+        if ((char *)p == numEnd)
+        {
+            *tokenOut++ = TOKEN_INTEGER;
+            *(long*)tokenOut = (long)val;
+            tokenOut += sizeof(long);
+        }
+        else
+        {
+            *tokenOut++ = TOKEN_NUMBER;
+            *(float*)tokenOut = f;
+            tokenOut += sizeof(float);
+        }
+
+        tokenIn = (uint8_t *)numEnd;
+        return 0;
+    }
+
+    /* Identifier: [a-zA-Z][a-zA-Z0-9]*[$] */
+    if (isalpha(*tokenIn))
+    {
+        char identStr[MAX_IDENT_LEN + 1];
+        int32_t identLen = 0;
+        identStr[identLen++] = *tokenIn++;  /* Copy first char */
+
+        while (isalnum(*tokenIn) || *tokenIn == '$')
+        {
+            if (identLen < MAX_IDENT_LEN)
+            {
+                identStr[identLen++] = *tokenIn;
+            }
+
+            tokenIn++;
+        }
+
+        identStr[identLen] = 0;
+
+        /* Check to see if this is a keyword */
+        for (i = FIRST_IDENT_TOKEN; i <= LAST_IDENT_TOKEN; i++)
+        {
+            if (strcasecmp(identStr, (char *)pgm_read_word(&tokenTable[i].token)) == 0)
+            {
+                if (tokenOutLeft <= 1)
+                {
+                    return ERROR_LEXER_TOO_LONG;
+                }
+
+                tokenOutLeft--;
+                *tokenOut++ = i;
+
+                /* Special case for REM */
+                if (i == TOKEN_REM)
+                {
+                    *tokenOut++ = TOKEN_STRING;
+
+                    /* Skip whitespace */
+                    while (isspace(*tokenIn))
                     {
                         tokenIn++;
                     }
@@ -1370,6 +1757,94 @@ int32_t parse_subscript_expr(void)
     return 0;
 }
 
+/* Parse (x1,....xn) for an element of an existing array e.g. a(i,j)
+   Each index is folded into the element offset as soon as it's evaluated, so
+   nothing is left on the calculator stack. Sets *pVar to the array variable
+   and *pElems to its elements (in execute mode only) */
+int32_t parse_array_element(char *name, int32_t type, uint8_t **pVar, uint8_t **pElems, int32_t *pOffset)
+{
+    uint16_t *dims = NULL;
+    int32_t numDims = 0, numDimsGiven = 0;
+    int32_t offset = 0, error = 0;
+
+    if (executeMode)
+    {
+        *pVar = find_array(name, type);
+        if (*pVar == NULL)
+        {
+            return ERROR_VARIABLE_NOT_FOUND;
+        }
+
+        dims = (uint16_t *)(*pVar + 3 + strlen(name) + 1);
+        numDims = *dims++;
+    }
+
+    if (curToken != TOKEN_LBRACKET)
+    {
+        return ERROR_EXPR_MISSING_BRACKET;
+    }
+
+    get_next_token();
+    while(1)
+    {
+        int32_t val = expect_number();
+        if (val)
+        {
+            return val;     /* Error */
+        }
+
+        if (executeMode && numDimsGiven < numDims)
+        {
+            /* Dims are stored last first, and the last index varies fastest */
+            int32_t index = (int32_t)stack_pop_num();
+            int32_t dim = dims[numDims - 1 - numDimsGiven];
+            if (index < 1 || index > dim)
+            {
+                error = ERROR_ARRAY_SUBSCRIPT_OUT_RANGE;
+            }
+
+            offset = offset * dim + index - 1;
+        }
+        else if (executeMode)
+        {
+            stack_pop_num();
+        }
+
+        numDimsGiven++;
+        if (curToken == TOKEN_RBRACKET)
+        {
+            break;
+        }
+        else if (curToken == TOKEN_COMMA)
+        {
+            get_next_token();
+        }
+        else
+        {
+            return ERROR_EXPR_MISSING_BRACKET;
+        }
+    }
+    get_next_token();       /* eat ) */
+
+    if (executeMode)
+    {
+        if (numDimsGiven != numDims)
+        {
+            return ERROR_WRONG_ARRAY_DIMENSIONS;
+        }
+
+        if (error)
+        {
+            return error;
+        }
+
+        *pElems = (uint8_t *)(dims + numDims);
+        *pOffset = offset;
+    }
+
+    return 0;
+}
+
 /* Parse a function call e.g. LEN(a$) */
 int32_t parse_fn_call_expr(void)
 {
@@ -1450,7 +1925,26 @@ int32_t parse_fn_call_expr(void)
                 break;
         case TOKEN_VAL:
             {
-                /* Tokenise str onto the stack */
+                /* A plain number is read directly */
+                const char *str = stack_get_str(), *numEnd;
+                float num = host_str_to_float(str, &numEnd);
+
+                if (numEnd != str)
+                {
+                    while (isspace((unsigned char)*numEnd))
+                    {
+                        numEnd++;
+                    }
+
+                    if (!*numEnd)
+                    {
+                        stack_pop_str();
+                        stack_push_num(num);
+                        break;
+                    }
+                }
+
+                /* Anything else is tokenised onto the stack and evaluated */
                 int32_t oldStackEnd = sysSTACKEND;
                 uint8_t *oldTokenBuffer = prevToken;
                 int32_t val = tokenize((unsigned char*)stack_get_str(), &mem[sysSTACKEND], sysVARSTART - sysSTACKEND);
@@ -1560,6 +2054,64 @@ int32_t parse_fn_call_expr(void)
                 }
             }
             break;
+        case TOKEN_PINLOST:
+            {
+                tmp = (int32_t)stack_pop_num();
+                if (!stack_push_num(host_pin_events_dropped(tmp)))
+                {
+                    return ERROR_OUT_OF_MEMORY;
+                }
+            }
+            break;
+        case TOKEN_PORTIN:
+            {
+                tmp = host_port_in((int32_t)stack_pop_num());
+                if (tmp < 0)
+                {
+                    return ERROR_BAD_PARAMETER;
+                }
+
+                if (!stack_push_num(tmp))
+                {
+                    return ERROR_OUT_OF_MEMORY;
+                }
+            }
+            break;
+        case TOKEN_ABS:
+            stack_push_num(fabsf(stack_pop_num()));
+            break;
+        case TOKEN_SQR:
+            {
+                float f = stack_pop_num();
+                if (f < 0)
+                {
+                    return ERROR_BAD_PARAMETER;
+                }
+                stack_push_num(sqrtf(f));
+            }
+            break;
+        case TOKEN_SIN:
+            stack_push_num(sinf(stack_pop_num()));
+            break;
+        case TOKEN_COS:
+            stack_push_num(cosf(stack_pop_num()));
+            break;
+        case TOKEN_ATN:
+            stack_push_num(atanf(stack_pop_num()));
+            break;
+        case TOKEN_EXP:
+            stack_push_num(expf(stack_pop_num()));
+            break;
+        case TOKEN_LOG:
+            {
+                float f = stack_pop_num();
+                if (f <= 0)
+                {
+                    return ERROR_BAD_PARAMETER;
+                }
+                stack_push_num(logf(f));
+            }
+            break;
         default:
             return ERROR_UNEXPECTED_TOKEN;
         }
@@ -1589,7 +2141,10 @@ int32_t parse_identifier_expr(void)
     if (curToken == TOKEN_LBRACKET)
     {
         /* Array access */
-        int32_t val = parse_subscript_expr();
+        uint8_t *var, *elems;
+        int32_t offset;
+        int32_t val = parse_array_element(ident, isStringIdentifier ? VAR_TYPE_STR_ARRAY : VAR_TYPE_NUM_ARRAY,
+                                          &var, &elems, &offset);
         if (val)
         {
             return val;
@@ -1599,26 +2154,14 @@ int32_t parse_identifier_expr(void)
         {
             if (isStringIdentifier)
             {
-                int32_t error = 0;
-                char *str = lookup_str_array_elem(ident, &error);
-                if (error)
-                {
-                    return error;
-                }
-                else if (!stack_push_str(str))
+                if (!stack_push_str(lookup_str_array_elem(elems, offset)))
                 {
                     return ERROR_OUT_OF_MEMORY;
                 }
             }
             else
             {
-                int32_t error = 0;
-                float f = lookup_num_array_elem(ident, &error);
-                if (error)
-                {
-                    return error;
-                }
-                else if (!stack_push_num(f))
+                if (!stack_push_num(lookup_num_array_elem(elems, offset)))
                 {
                     return ERROR_OUT_OF_MEMORY;
                 }
@@ -1702,6 +2245,21 @@ int32_t parse_RND(void)
     return TYPE_NUMBER;
 }
 
+int32_t parse_SAMPLED(void)
+{
+    get_next_token();
+    if (executeMode)
+    {
+        collect_samples();
+        if (!stack_push_num(sampleStored))
+        {
+            return ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    return TYPE_NUMBER;
+}
+
 int32_t parse_INKEY(void)
 {
     get_next_token();
@@ -1798,6 +2356,10 @@ int32_t parse_primary(void)
             ret = parse_INKEY();
             break;
 
+        case TOKEN_SAMPLED:
+            ret = parse_SAMPLED();
+            break;
+
         /* Unary ops */
         case TOKEN_MINUS:
         case TOKEN_NOT:
@@ -1814,6 +2376,15 @@ int32_t parse_primary(void)
         case TOKEN_MID:
         case TOKEN_PINREAD:
         case TOKEN_ANALOGRD:
+        case TOKEN_PINLOST:
+        case TOKEN_PORTIN:
+        case TOKEN_ABS:
+        case TOKEN_SQR:
+        case TOKEN_SIN:
+        case TOKEN_COS:
+        case TOKEN_ATN:
+        case TOKEN_EXP:
+        case TOKEN_LOG:
             ret = parse_fn_call_expr();
             break;
 
@@ -2136,6 +2707,10 @@ int32_t parse_RUN(void)
     {
         /* Clear variables */
         sysVARSTART = sysVAREND = sysGOSUBSTART = sysGOSUBEND = MEMORY_SIZE;
+        invalidate_array_cache();
+        restore_data(&mem[0]);
+        clear_event_handlers();
+        stop_sampling();
         jumpLineNumber = startLine;
         stopLineNumber = stopStmtNumber = 0;
     }
@@ -2187,6 +2762,14 @@ int32_t parse_PAUSE(void)
             return ERROR_BAD_PARAMETER;
         }
 
+        /* A short step at a time while SAMPLE's readings need collecting */
+        while (sampleArray[0] && ms > 0)
+        {
+            host_sleep(1);
+            ms--;
+            collect_samples();
+        }
+
         host_sleep(ms);
     }
 
@@ -2343,11 +2926,18 @@ int32_t parse_two_int_cmd(void)
     return 0;
 }
 
-/* This handles both LET a$="hello" and INPUT a$ type assignments */
-int32_t parse_assignment(bool inputStmt)
+/* Where parse_assignment gets the value from */
+#define ASSIGN_LET                              0
+#define ASSIGN_INPUT                            1
+#define ASSIGN_READ                             2
+
+/* This handles LET a$="hello", INPUT a$ and READ a$ type assignments */
+int32_t parse_assignment(int32_t from)
 {
     char ident[MAX_IDENT_LEN + 1];
     int32_t val, isStringIdentifier, isArray = 0;
+    uint8_t *var, *elems;
+    int32_t offset;
 
     if (curToken != TOKEN_IDENT)
     {
@@ -2366,7 +2956,8 @@ int32_t parse_assignment(bool inputStmt)
     if (curToken == TOKEN_LBRACKET)
     {
         /* Array element being set */
-        val = parse_subscript_expr();
+        val = parse_array_element(ident, isStringIdentifier ? VAR_TYPE_STR_ARRAY : VAR_TYPE_NUM_ARRAY,
+                                  &var, &elems, &offset);
         if (val)
         {
             return val;
@@ -2375,7 +2966,7 @@ int32_t parse_assignment(bool inputStmt)
         isArray = 1;
     }
 
-    if (inputStmt)
+    if (from == ASSIGN_INPUT)
     {
         /* From INPUT statement */
         if (executeMode)
@@ -2390,7 +2981,7 @@ int32_t parse_assignment(bool inputStmt)
             }
             else
             {
-                float f = (float)strtod(inputStr, 0);
+                float f = host_str_to_float(inputStr, 0);
                 if (!stack_push_num(f))
                 {
                     return ERROR_OUT_OF_MEMORY;
@@ -2403,6 +2994,20 @@ int32_t parse_assignment(bool inputStmt)
 
         val = isStringIdentifier ? TYPE_STRING : TYPE_NUMBER;
     }
+    else if (from == ASSIGN_READ)
+    {
+        /* From READ statement */
+        if (executeMode)
+        {
+            val = read_data(isStringIdentifier);
+            if (val)
+            {
+                return val;
+            }
+        }
+
+        val = isStringIdentifier ? TYPE_STRING : TYPE_NUMBER;
+    }
     else
     {
         /* From LET statement */
@@ -2432,11 +3037,7 @@ int32_t parse_assignment(bool inputStmt)
         {
             if (isArray)
             {
-                val = set_num_array_elem(ident, stack_pop_num());
-                if (val)
-                {
-                    return val;
-                }
+                set_num_array_elem(elems, offset, stack_pop_num());
             }
             else
             {
@@ -2459,14 +3060,13 @@ int32_t parse_assignment(bool inputStmt)
         {
             if (isArray)
             {
-                /* Annoyingly, we've got the string at the top of the stack
-                   (from parse_expression) and the array index stuff (from
-                   parse_subscript_expr) underneath */
-                val = set_str_array_elem(ident);
+                val = set_str_array_elem(var, elems, offset, stack_get_str());
                 if (val)
                 {
                     return val;
                 }
+
+                stack_pop_str();
             }
             else
             {
@@ -2653,14 +3253,150 @@ int32_t parse_GOSUB(void)
         uint16_t startLine = (uint16_t)stack_pop_num();
         if (startLine <= 0)
         {
-            return ERROR_BAD_LINE_NUM;
+            return ERROR_BAD_LINE_NUM;
+        }
+
+        jumpLineNumber = startLine;
+
+        if (!gosub_stack_push(lineNumber,stmtNumber))
+        {
+            return ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    return 0;
+}
+
+/* ON TIMER ms GOSUB line, or ON TIMER OFF */
+int32_t parse_on_timer(void)
+{
+    int32_t val;
+
+    get_next_token();       /* Eat TIMER */
+    if (curToken == TOKEN_OFF)
+    {
+        get_next_token();
+        if (executeMode)
+        {
+            clear_timers();
+        }
+        return 0;
+    }
+
+    val = expect_number();
+    if (val)
+    {
+        return val;         /* Error */
+    }
+
+    if (curToken != TOKEN_GOSUB)
+    {
+        return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    get_next_token();       /* Eat GOSUB */
+    val = expect_number();
+    if (val)
+    {
+        return val;         /* Error */
+    }
+
+    if (executeMode)
+    {
+        uint16_t line = (uint16_t)stack_pop_num();
+        float period;
+
+        if (line <= 0)
+        {
+            return ERROR_BAD_LINE_NUM;
+        }
+
+        period = stack_pop_num();
+        if (period < 0 || period >= INT32_MAX || !set_timer((uint32_t)period, line))
+        {
+            return ERROR_BAD_PARAMETER;
+        }
+    }
+
+    return 0;
+}
+
+/* ON PIN n RISING|FALLING|CHANGE GOSUB line, ON PIN n OFF or ON TIMER ... */
+int32_t parse_ON(void)
+{
+    int32_t val, mode;
+    uint16_t line = 0;
+
+    get_next_token();       /* Eat ON */
+    if (curToken == TOKEN_TIMER)
+    {
+        return parse_on_timer();
+    }
+
+    if (curToken != TOKEN_PIN)
+    {
+        return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    get_next_token();       /* Eat PIN */
+    val = expect_number();
+    if (val)
+    {
+        return val;         /* Error */
+    }
+
+    switch (curToken)
+    {
+        case TOKEN_RISING:
+            mode = PIN_EVENT_RISING;
+            break;
+
+        case TOKEN_FALLING:
+            mode = PIN_EVENT_FALLING;
+            break;
+
+        case TOKEN_CHANGE:
+            mode = PIN_EVENT_CHANGE;
+            break;
+
+        case TOKEN_OFF:
+            mode = PIN_EVENT_OFF;
+            break;
+
+        default:
+            return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    get_next_token();
+    if (mode != PIN_EVENT_OFF)
+    {
+        if (curToken != TOKEN_GOSUB)
+        {
+            return ERROR_UNEXPECTED_TOKEN;
+        }
+
+        get_next_token();   /* Eat GOSUB */
+        val = expect_number();
+        if (val)
+        {
+            return val;     /* Error */
         }
 
-        jumpLineNumber = startLine;
+        if (executeMode)
+        {
+            line = (uint16_t)stack_pop_num();
+            if (line <= 0)
+            {
+                return ERROR_BAD_LINE_NUM;
+            }
+        }
+    }
 
-        if (!gosub_stack_push(lineNumber,stmtNumber))
+    if (executeMode)
+    {
+        if (!set_pin_handler((int32_t)stack_pop_num(), mode, line))
         {
-            return ERROR_OUT_OF_MEMORY;
+            return ERROR_BAD_PARAMETER;
         }
     }
 
@@ -2863,6 +3599,273 @@ int32_t parse_DIM(void)
     return 0;
 }
 
+/* DATA 1, -2.5, "three" */
+int32_t parse_DATA(void)
+{
+    get_next_token();               /* Eat DATA */
+    while (1)
+    {
+        if (curToken == TOKEN_MINUS)
+        {
+            get_next_token();
+            if (curToken != TOKEN_NUMBER && curToken != TOKEN_INTEGER)
+            {
+                return ERROR_EXPR_EXPECTED_NUM;
+            }
+        }
+        else if (curToken != TOKEN_NUMBER && curToken != TOKEN_INTEGER && curToken != TOKEN_STRING)
+        {
+            return ERROR_UNEXPECTED_TOKEN;
+        }
+
+        get_next_token();           /* The items are read by READ, not here */
+        if (curToken != TOKEN_COMMA)
+        {
+            break;
+        }
+
+        get_next_token();           /* Eat , */
+    }
+
+    return 0;
+}
+
+/* READ a, b$, c(i) */
+int32_t parse_READ(void)
+{
+    get_next_token();               /* Eat READ */
+    while (1)
+    {
+        int32_t val = parse_assignment(ASSIGN_READ);
+        if (val)
+        {
+            return val;
+        }
+
+        if (curToken != TOKEN_COMMA)
+        {
+            break;
+        }
+
+        get_next_token();           /* Eat , */
+    }
+
+    return 0;
+}
+
+/* RESTORE or RESTORE n */
+int32_t parse_RESTORE(void)
+{
+    uint16_t line = 0;
+
+    get_next_token();               /* Eat RESTORE */
+    if (curToken != TOKEN_EOL && curToken != TOKEN_CMD_SEP)
+    {
+        int32_t val = expect_number();
+        if (val)
+        {
+            return val;             /* Error */
+        }
+
+        if (executeMode)
+        {
+            line = (uint16_t)stack_pop_num();
+        }
+    }
+
+    if (executeMode)
+    {
+        restore_data(find_prog_line(line));
+    }
+
+    return 0;
+}
+
+/* SAMPLE pin, array, count, rate */
+int32_t parse_SAMPLE(void)
+{
+    char ident[MAX_IDENT_LEN + 1];
+    int32_t val;
+
+    get_next_token();       /* Eat SAMPLE */
+    val = expect_number();
+    if (val)
+    {
+        return val;         /* Error */
+    }
+
+    if (curToken != TOKEN_COMMA)
+    {
+        return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    get_next_token();
+    if (curToken != TOKEN_IDENT || isStrIdent)
+    {
+        return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    if (executeMode)
+    {
+        strcpy(ident, identVal);
+    }
+
+    get_next_token();       /* Eat ident */
+    if (curToken != TOKEN_COMMA)
+    {
+        return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    get_next_token();
+    val = expect_number();
+    if (val)
+    {
+        return val;         /* Error */
+    }
+
+    if (curToken != TOKEN_COMMA)
+    {
+        return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    get_next_token();
+    val = expect_number();
+    if (val)
+    {
+        return val;         /* Error */
+    }
+
+    if (executeMode)
+    {
+        float rate = stack_pop_num();
+        int32_t count = (int32_t)stack_pop_num();
+        int32_t pin = (int32_t)stack_pop_num();
+
+        if (rate < 1 || rate >= INT32_MAX)
+        {
+            return ERROR_BAD_PARAMETER;
+        }
+
+        return start_sampling(pin, ident, count, (uint32_t)rate);
+    }
+
+    return 0;
+}
+
+/* PORTOUT port, mask, value */
+int32_t parse_PORTOUT(void)
+{
+    int32_t i, val, mask, value;
+
+    get_next_token();       /* Eat PORTOUT */
+    for (i = 0; i < 3; i++)
+    {
+        if (i)
+        {
+            if (curToken != TOKEN_COMMA)
+            {
+                return ERROR_UNEXPECTED_TOKEN;
+            }
+
+            get_next_token();
+        }
+
+        val = expect_number();
+        if (val)
+        {
+            return val;     /* Error */
+        }
+    }
+
+    if (executeMode)
+    {
+        value = (int32_t)stack_pop_num();
+        mask = (int32_t)stack_pop_num();
+        if (!host_port_out((int32_t)stack_pop_num(), mask, value))
+        {
+            return ERROR_BAD_PARAMETER;
+        }
+    }
+
+    return 0;
+}
+
+/* SHIFTOUT dataPin, clockPin, bitOrder, array, count */
+int32_t parse_SHIFTOUT(void)
+{
+    char ident[MAX_IDENT_LEN + 1];
+    int32_t i, val;
+
+    get_next_token();       /* Eat SHIFTOUT */
+    for (i = 0; i < 3; i++)
+    {
+        val = expect_number();
+        if (val)
+        {
+            return val;     /* Error */
+        }
+
+        if (curToken != TOKEN_COMMA)
+        {
+            return ERROR_UNEXPECTED_TOKEN;
+        }
+
+        get_next_token();
+    }
+
+    if (curToken != TOKEN_IDENT || isStrIdent)
+    {
+        return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    if (executeMode)
+    {
+        strcpy(ident, identVal);
+    }
+
+    get_next_token();       /* Eat ident */
+    if (curToken != TOKEN_COMMA)
+    {
+        return ERROR_UNEXPECTED_TOKEN;
+    }
+
+    get_next_token();
+    val = expect_number();
+    if (val)
+    {
+        return val;         /* Error */
+    }
+
+    if (executeMode)
+    {
+        int32_t count = (int32_t)stack_pop_num();
+        int32_t bitOrder = (int32_t)stack_pop_num();
+        int32_t clockPin = (int32_t)stack_pop_num();
+        int32_t dataPin = (int32_t)stack_pop_num();
+        int32_t numElements;
+        float *elems;
+        uint8_t *var = find_array(ident, VAR_TYPE_NUM_ARRAY);
+
+        if (var == NULL)
+        {
+            return ERROR_VARIABLE_NOT_FOUND;
+        }
+
+        elems = num_array_elems(var, ident, &numElements);
+        if (count < 0 || count > numElements)
+        {
+            return ERROR_ARRAY_SUBSCRIPT_OUT_RANGE;
+        }
+
+        if (!host_shift_out(dataPin, clockPin, bitOrder, elems, count))
+        {
+            return ERROR_BAD_PARAMETER;
+        }
+    }
+
+    return 0;
+}
+
 static int32_t targetStmtNumber;
 
 int32_t parse_stmts(void)
@@ -2894,16 +3897,16 @@ int32_t parse_stmts(void)
 
             case TOKEN_LET:
                 get_next_token();
-                ret = parse_assignment(false);
+                ret = parse_assignment(ASSIGN_LET);
                 break;
 
             case TOKEN_IDENT:
-                ret = parse_assignment(false);
+                ret = parse_assignment(ASSIGN_LET);
                 break;
 
             case TOKEN_INPUT:
                 get_next_token();
-                ret = parse_assignment(true);
+                ret = parse_assignment(ASSIGN_INPUT);
                 break;
 
             case TOKEN_LIST:
@@ -2940,6 +3943,10 @@ int32_t parse_stmts(void)
                 ret = parse_GOSUB();
                 break;
 
+            case TOKEN_ON:
+                ret = parse_ON();
+                break;
+
             case TOKEN_DIM:
                 ret = parse_DIM();
                 break;
@@ -2948,6 +3955,30 @@ int32_t parse_stmts(void)
                 ret = parse_PAUSE();
                 break;
 
+            case TOKEN_DATA:
+                ret = parse_DATA();
+                break;
+
+            case TOKEN_READ:
+                ret = parse_READ();
+                break;
+
+            case TOKEN_RESTORE:
+                ret = parse_RESTORE();
+                break;
+
+            case TOKEN_SAMPLE:
+                ret = parse_SAMPLE();
+                break;
+
+            case TOKEN_PORTOUT:
+                ret = parse_PORTOUT();
+                break;
+
+            case TOKEN_SHIFTOUT:
+                ret = parse_SHIFTOUT();
+                break;
+
             case TOKEN_LOAD:
             case TOKEN_SAVE:
             case TOKEN_DELETE:
@@ -3138,6 +4169,35 @@ int32_t process_input(uint8_t *tokenBuf)
                 targetStmtNumber = jumpStmtNumber;
             }
 
+            collect_samples();
+
+            /* Run any event handler first, as a GOSUB from the statement about
+               to execute. RETURN resumes at the statement after the one pushed,
+               and a target of 0 is pushed as 65535 which wraps back round to 0. */
+            if (lineNumber)
+            {
+                uint16_t handlerLine = next_event_handler();
+                if (handlerLine)
+                {
+                    if (!gosub_stack_push(lineNumber, (uint16_t)(targetStmtNumber - 1)))
+                    {
+                        ret = ERROR_OUT_OF_MEMORY;
+                        break;
+                    }
+
+                    eventGosubDepth = sysGOSUBEND - sysGOSUBSTART;
+                    p = find_prog_line(handlerLine);
+                    if (p == &mem[sysPROGEND])
+                    {
+                        break;          /* End of program */
+                    }
+
+                    lineNumber = *(uint16_t*)(p + 2);
+                    tokenBuffer = p + 4;
+                    targetStmtNumber = 0;
+                }
+            }
+
             if (host_esc_pressed())
             {
                 ret = ERROR_BREAK_PRESSED;
@@ -3159,6 +4219,10 @@ void reset_basic(void)
 
     /* variables/gosub stack at the end of memory */
     sysVARSTART = sysVAREND = sysGOSUBSTART = sysGOSUBEND = MEMORY_SIZE;
+    invalidate_array_cache();
+    restore_data(&mem[0]);
+    clear_event_handlers();
+    stop_sampling();
     memset(&mem[0], 0, MEMORY_SIZE);
 
     stopLineNumber = 0;
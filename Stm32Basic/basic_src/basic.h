@@ -70,9 +70,31 @@
 #define TOKEN_ANALOGRD          63
 #define TOKEN_DIR               64
 #define TOKEN_DELETE            65
+#define TOKEN_DATA              66
+#define TOKEN_READ              67
+#define TOKEN_RESTORE           68
+#define TOKEN_ABS               69
+#define TOKEN_SQR               70
+#define TOKEN_SIN               71
+#define TOKEN_COS               72
+#define TOKEN_ATN               73
+#define TOKEN_EXP               74
+#define TOKEN_LOG               75
+#define TOKEN_ON                76
+#define TOKEN_RISING            77
+#define TOKEN_FALLING           78
+#define TOKEN_CHANGE            79
+#define TOKEN_OFF               80
+#define TOKEN_PINLOST           81
+#define TOKEN_TIMER             82
+#define TOKEN_SAMPLE            83
+#define TOKEN_SAMPLED           84
+#define TOKEN_PORTOUT           85
+#define TOKEN_PORTIN            86
+#define TOKEN_SHIFTOUT          87
 
 #define FIRST_IDENT_TOKEN       23
-#define LAST_IDENT_TOKEN        65
+#define LAST_IDENT_TOKEN        87
 
 #define FIRST_NON_ALPHA_TOKEN   8
 #define LAST_NON_ALPHA_TOKEN    22
@@ -105,9 +127,10 @@
 #define ERROR_STR_SUBSCRIPT_OUT_RANGE	    22
 #define ERROR_IN_VAL_INPUT			          23
 #define ERROR_BAD_PARAMETER               24
+#define ERROR_OUT_OF_DATA                 25
 
 #define MAX_IDENT_LEN	                    8
-#define MAX_NUMBER_LEN	                  10
+#define EVENT_TIMERS                        4       /* ON TIMERs running at once */
 #define TOKEN_BUF_SIZE                    128
 #define MEMORY_SIZE	                      1024*8
 
@@ -149,11 +172,12 @@ int32_t stack_push_num(float val);
 float stack_pop_num(void);
 int32_t stack_push_str(char *str);
 int32_t create_array(char *name, int32_t isString);
-int32_t get_array_elem_offset(uint8_t **p, int32_t *pOffset);
-int32_t set_num_array_elem(char *name, float val);
-int32_t set_str_array_elem(char *name);
-float lookup_num_array_elem(char *name, int32_t *error);
-char *lookup_str_array_elem(char *name, int32_t *error);
+void invalidate_array_cache(void);
+uint8_t *find_array(char *name, int32_t type);
+void set_num_array_elem(uint8_t *elems, int32_t offset, float val);
+int32_t set_str_array_elem(uint8_t *var, uint8_t *elems, int32_t offset, char *val);
+float lookup_num_array_elem(uint8_t *elems, int32_t offset);
+char *lookup_str_array_elem(uint8_t *elems, int32_t offset);
 float lookup_num_variable(char *name);
 int32_t store_str_variable(char *name, char *val);
 char *lookup_str_variable(char *name);
@@ -172,12 +196,14 @@ int32_t next_token(void);
 int32_t get_next_token(void);
 int32_t parse_number_expr(void);
 int32_t parse_subscript_expr(void);
+int32_t parse_array_element(char *name, int32_t type, uint8_t **pVar, uint8_t **pElems, int32_t *pOffset);
 int32_t parse_fn_call_expr(void);
 int32_t parse_identifier_expr(void);
 int32_t parse_string_expr(void);
 int32_t parse_paren_expr(void);
 int32_t parse_RND(void);
 int32_t parse_INKEY(void);
+int32_t parse_SAMPLED(void);
 int32_t parse_unary_num_exp(void);
 int32_t get_to_k_precedence(void);
 int32_t parse_bin_op_RHS(int32_t ExprPrec, int32_t lhsVal);
@@ -187,15 +213,36 @@ int32_t parse_PAUSE(void);
 int32_t parse_LIST(void);
 int32_t parse_PRINT(void);
 int32_t parse_two_int_cmd(void);
-int32_t parse_assignment(bool inputStmt);
+int32_t parse_assignment(int32_t from);
 int32_t parse_IF(void);
 int32_t parse_FOR(void);
 int32_t parse_NEXT(void);
 int32_t parse_GOSUB(void);
+int32_t parse_on_timer(void);
+int32_t parse_ON(void);
 int32_t parse_load_save_cmd(void);
 int32_t parse_simple_cmd(void);
 int32_t parse_DIM(void);
+int32_t parse_DATA(void);
+int32_t parse_READ(void);
+int32_t parse_RESTORE(void);
+int32_t parse_SAMPLE(void);
+int32_t parse_PORTOUT(void);
+int32_t parse_SHIFTOUT(void);
 int32_t parse_stmts(void);
+void restore_data(uint8_t *line);
+uint8_t *skip_token(uint8_t *p);
+uint8_t *find_data_item(void);
+int32_t read_data(int32_t isString);
+void clear_event_handlers(void);
+void clear_timers(void);
+int32_t set_timer(uint32_t period, uint16_t line);
+void stop_sampling(void);
+float *num_array_elems(uint8_t *var, char *name, int32_t *numElements);
+int32_t start_sampling(int32_t pin, char *name, int32_t count, uint32_t rate);
+void collect_samples(void);
+int32_t set_pin_handler(int32_t pin, int32_t mode, uint16_t line);
+uint16_t next_event_handler(void);
 
 int32_t store_for_next_variable(
     char *name, 
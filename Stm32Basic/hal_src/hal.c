@@ -2,12 +2,15 @@
 
 /* GLobal variables */
 static volatile uint32_t systick_cnt;
+static volatile uint32_t systick_ms;    /* Since systick_setup(), never reset */
+static uint8_t systick_sub_ms;
 
 void clock_setup(void)
 {
     rcc_clock_setup_in_hse_8mhz_out_72mhz();    /* 72 MHz */
     rcc_periph_clock_enable(RCC_GPIOA);
     rcc_periph_clock_enable(RCC_GPIOB);
+    rcc_periph_clock_enable(RCC_GPIOC);
     rcc_periph_clock_enable(RCC_USART1);
     rcc_periph_clock_enable(RCC_I2C1);
     rcc_periph_clock_enable(RCC_AFIO);
@@ -224,9 +227,76 @@ void systick_setup(void)
     systick_counter_enable();
 }
 
+void timer2_setup(uint32_t period_us)
+{
+    rcc_periph_clock_enable(RCC_TIM2);
+
+    /* APB1 is 36MHz, so TIM2 is clocked at 72MHz; count in microseconds */
+    timer_set_mode(TIM2, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    timer_set_prescaler(TIM2, 72 - 1);
+    timer_set_period(TIM2, period_us - 1);
+
+    /* Interrupt on every update; tim2_isr() is in host.c */
+    timer_enable_irq(TIM2, TIM_DIER_UIE);
+    nvic_enable_irq(NVIC_TIM2_IRQ);
+    timer_enable_counter(TIM2);
+}
+
+void timer3_trigger_setup(uint32_t rate)
+{
+    rcc_periph_clock_enable(RCC_TIM3);
+    rcc_periph_reset_pulse(RST_TIM3);
+
+    /* TIM3 is clocked at 72MHz too; count in microseconds, or in 100us
+       steps below 100Hz so the period fits in 16 bits */
+    timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    if (rate >= 100)
+    {
+        timer_set_prescaler(TIM3, 72 - 1);
+        timer_set_period(TIM3, (1000000 + rate / 2) / rate - 1);
+    }
+    else
+    {
+        timer_set_prescaler(TIM3, 7200 - 1);
+        timer_set_period(TIM3, (10000 + rate / 2) / rate - 1);
+    }
+
+    /* Every update is sent out on TRGO, which starts an ADC conversion */
+    timer_set_master_mode(TIM3, TIM_CR2_MMS_UPDATE);
+    timer_enable_counter(TIM3);
+}
+
+void adc_setup(void)
+{
+    rcc_periph_clock_enable(RCC_ADC1);
+
+    /* One channel at a time, converted once per trigger */
+    adc_power_off(ADC1);
+    adc_disable_scan_mode(ADC1);
+    adc_set_single_conversion_mode(ADC1);
+    adc_set_right_aligned(ADC1);
+    adc_set_sample_time_on_all_channels(ADC1, ADC_SMPR_SMP_28DOT5CYC);
+
+    /* The ADC needs a moment after power on before it can calibrate */
+    adc_power_on(ADC1);
+    delay_us100(1);
+    adc_reset_calibration(ADC1);
+    adc_calibrate(ADC1);
+}
+
 void sys_tick_handler(void)
 {
     systick_cnt++;
+    if (++systick_sub_ms == 10)
+    {
+        systick_sub_ms = 0;
+        systick_ms++;
+    }
+}
+
+uint32_t systick_millis(void)
+{
+    return systick_ms;
 }
 
 void delay_us100(uint32_t us100)
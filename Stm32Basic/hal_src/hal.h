@@ -6,9 +6,13 @@
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/stm32/usart.h>
 #include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/dma.h>
 #include <libopencm3/cm3/nvic.h>
 #include <libopencm3/stm32/timer.h>
 #include <libopencm3/cm3/systick.h>
+#include <libopencm3/cm3/cortex.h>
 #endif
 
 /********************** Keyboard **********************/
@@ -58,7 +62,11 @@
 
 void clock_setup(void);
 void systick_setup(void);
+void timer2_setup(uint32_t period_us);
+void timer3_trigger_setup(uint32_t rate);
+void adc_setup(void);
 void delay_us100(uint32_t us100);
+uint32_t systick_millis(void);
 void usart_setup(void);
 void usart_send_string(uint32_t usart, const char *string, uint16_t str_size);
 void uart_write_number(uint32_t usart, uint32_t num);
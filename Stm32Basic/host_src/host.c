@@ -3,9 +3,14 @@
  *  https://github.com/robinhedwards/ArduinoBASIC
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 #include <stdint.h>
+#ifdef PCBASIC_TARGET
+#include <time.h>
+#endif
 #include "host.h"
 #include "../hal_src/hal.h"
 #include "../basic_src/basic.h"
@@ -34,6 +39,37 @@ char buzPin = 0
 
 #ifdef PCBASIC_TARGET
 volatile uint8_t cur_x = 1;
+
+/*
+ * Keys come from the console, or from a replay file opened with
+ * host_input_replay(). Each line of a replay file is a time in ms from
+ * the start of the replay, one space, then the keys typed at that time:
+ *
+ *     # comment
+ *     500 PRINT 1+1\n
+ *     900 10 IF INKEY$="" THEN GOTO 10\n
+ *     1200 RUN\n
+ *     3000 \e
+ *
+ * \n is Enter, \b Delete, \e Esc and \\ a backslash. A key isn't handed
+ * over before its time, so INKEY$ and INPUT see it when a person would
+ * have typed it. When a line is wanted after the last key, the echo
+ * latency report is printed on stderr and pcbasic exits.
+ *
+ * Echo latency is the time from when a key was due to the end of the next
+ * screen update (the echo in host_readLine() or host_showBuffer()).
+ */
+FILE *replayFile = NULL;
+long long replayStartUs;
+long replayDueMs;
+char replayKeys[256];
+int replayPos = 0, replayLen = 0;
+int pendingKey = -1;                    /* Read by host_esc_pressed() */
+long long lastPollUs = 0;
+long long echoDueUs[64];                /* Keys not shown yet */
+uint8_t echoHead = 0, echoTail = 0;
+long latencyUs[REPLAY_MAX_KEYS];
+int latencyCount = 0;
 #endif
 
 #ifdef SD_CARD_IN_USE
@@ -41,13 +77,27 @@ volatile uint8_t cur_x = 1;
 #endif
 
 #ifdef KEYPAD_8x5_IN_USE
-volatile uint8_t value_ROW = 1;
-volatile uint8_t COLs_array[ROWS];
-volatile uint8_t key_check_state_machine = E_set_row_1st;
-volatile bool key_pressed = false;
-volatile bool key_not_printed = true;
-volatile uint16_t keypress_timeout_counter = 0;
+/*
+ * The whole keyboard is scanned on every TIM2 interrupt. A key has to read
+ * the same for KBD_DEBOUNCE_SCANS scans before a press or release counts,
+ * and each key is debounced on its own, so several can be down at once.
+ * Pressing a key queues its character in kbd_buf, which get_key() reads
+ * from the main loop. The interrupt is the only writer of kbd_head and
+ * get_key() the only writer of kbd_tail, so no locking is needed. Shift is
+ * a modifier and sends nothing itself. The last key pressed repeats while
+ * it is held.
+ */
+uint8_t kbd_down[ROWS];                         /* Debounced state, a bit per input line */
+uint8_t kbd_count[ROWS][KBD_LINES];             /* Scans each key has read differently */
+int8_t kbd_repeat_row = -1, kbd_repeat_line;    /* Key that repeats */
+uint16_t kbd_repeat_scans;                      /* Until it next repeats */
+volatile char kbd_buf[KBD_BUF_SIZE];
+volatile uint8_t kbd_head = 0, kbd_tail = 0;
 
+/*
+ * An input line reads as bit n, and the maps are indexed by the value
+ * read minus one, so line n is column (1 << n) - 1.
+ */
 // TODO
 const char key_map[ROWS][COLS] =
 {//COL 0  1   2   3   4   5   6   7   8   9  10  11  12  13  14  15           ROW
@@ -68,7 +118,7 @@ const char key_map_shift[ROWS][COLS] =
     {KEY_DELETE,'s','f','g','h','j','k','x','c','v','b','n','f','d','s','a'}, // 2
     {'v','b','q','w','e','r','t','y','d','s','c','v','b','g','f','d'},        // 3
     {'"',')','d','(','f','g','n','?','k','j','h','g','f','s','a','s'},        // 4
-    {'q','w','e','r','t','y','u','i','o','p','z','x','c','v','b','w'},        // 5
+    {'q',':','e',';','t','y','u','?','o','p','z','x','c','v','b','/'},        // 5
     {'a','=','d','s','a','r','t','y','u','i','o','b','f','d','s','e'},        // 6
     {'q',',','e','>','t','y','u','<','f','g','h','x','w','e','r','*'},        // 7
 };
@@ -78,28 +128,99 @@ const char bytesFreeStr[] = "bytes free";
 
 #ifndef PCBASIC_TARGET
 #ifdef KEYPAD_8x5_IN_USE
+static bool kbd_shift_down(void)
+{
+    int row, line;
+
+    for (row = 0; row < ROWS; row++)
+    {
+        for (line = 0; line < KBD_LINES; line++)
+        {
+            if ((kbd_down[row] & (1 << line)) &&
+                key_map[row][(1 << line) - 1] == KEY_SHIFT)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void kbd_put(int row, int line)
+{
+    int col = (1 << line) - 1;
+    char key = kbd_shift_down() ? key_map_shift[row][col] : key_map[row][col];
+
+    if ((uint8_t)(kbd_head - kbd_tail) < KBD_BUF_SIZE)       /* Else it's lost */
+    {
+        kbd_buf[kbd_head & (KBD_BUF_SIZE - 1)] = key;
+        kbd_head++;
+    }
+}
+
 void handler_timer_int(void)
 {
-    switch(key_check_state_machine)
+    int row, line, i;
+
+    for (row = 0; row < ROWS; row++)
     {
-        case E_set_row_1st:
-            state_machine_set_row_1st();
-            break;
+        uint8_t bits;
 
-        case E_read_col_1st:
-            state_machine_read_column_1st();
-            break;
+        set_KBD2(row + 1);
 
-        case E_set_row_2nd:
-            state_machine_set_row_2nd();
-            break;
+        for (i = 0; i < KBD_SETTLE_LOOPS; i++)
+            __asm__("NOP");
 
-        case E_read_col_2nd:
-            state_machine_read_column_2nd();
-            break;
+        bits = read_KBD1();
 
-        default:
-            break;
+        for (line = 0; line < KBD_LINES; line++)
+        {
+            uint8_t mask = 1 << line;
+
+            if ((bits & mask) == (kbd_down[row] & mask))
+            {
+                kbd_count[row][line] = 0;
+            }
+            else if (++kbd_count[row][line] >= KBD_DEBOUNCE_SCANS)
+            {
+                kbd_count[row][line] = 0;
+                kbd_down[row] ^= mask;
+
+                if (key_map[row][mask - 1] == KEY_SHIFT)
+                {
+                    /* Modifier only */
+                }
+                else if (bits & mask)
+                {
+                    kbd_put(row, line);
+                    kbd_repeat_row = row;
+                    kbd_repeat_line = line;
+                    kbd_repeat_scans = KBD_REPEAT_DELAY;
+                }
+                else if (row == kbd_repeat_row && line == kbd_repeat_line)
+                {
+                    kbd_repeat_row = -1;
+                }
+            }
+        }
+    }
+
+    reset_KBD2();
+
+    if (kbd_repeat_row >= 0 && --kbd_repeat_scans == 0)
+    {
+        kbd_put(kbd_repeat_row, kbd_repeat_line);
+        kbd_repeat_scans = KBD_REPEAT_RATE;
+    }
+}
+
+void tim2_isr(void)
+{
+    if (timer_get_flag(TIM2, TIM_SR_UIF))
+    {
+        timer_clear_flag(TIM2, TIM_SR_UIF);
+        handler_timer_int();
     }
 }
 #endif
@@ -170,6 +291,7 @@ void host_init(int buzzerPin)
 
     clock_setup();
     host_sleep(500);
+    adc_setup();
     init_KBD();
 
 #ifdef SERIAL_TRACES_ON
@@ -193,6 +315,7 @@ void host_init(int buzzerPin)
 #ifdef KEYPAD_8x5_IN_USE
     init_KBD();
     reset_KBD2();
+    timer2_setup(TIMER2_PERIOD);
 #endif
 
 #ifdef BUZZER_IN_USE
@@ -236,31 +359,619 @@ void host_sleep(long ms)
 #endif
 }
 
+/* Milliseconds from a monotonic clock, wrapping at 2^32 */
+uint32_t host_millis(void)
+{
+#ifdef PCBASIC_TARGET
+#ifdef WIN32
+    return GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+#else
+    return systick_millis();
+#endif
+}
+
+/*
+ * Pin change events for ON PIN. The interrupt side is the only writer of
+ * pin_event_head and host_get_pin_event() the only writer of pin_event_tail,
+ * so the ring needs no locking. A full ring drops the edge and counts it
+ * against the pin.
+ */
+static struct
+{
+    uint8_t pin;
+    uint8_t mode;           /* PIN_EVENT_OFF = slot free */
+    uint16_t dropped;
+} pin_watch[PIN_EVENT_SLOTS];
+static volatile uint8_t pin_event_buf[PIN_EVENT_QUEUE];
+static volatile uint8_t pin_event_head;
+static volatile uint8_t pin_event_tail;
+
+/* Queue an edge on the pin watched in slot */
+static void pin_event(int slot)
+{
+    if ((uint8_t)(pin_event_head - pin_event_tail) < PIN_EVENT_QUEUE)
+    {
+        pin_event_buf[pin_event_head & (PIN_EVENT_QUEUE - 1)] = pin_watch[slot].pin;
+        pin_event_head++;
+    }
+    else
+    {
+        pin_watch[slot].dropped++;
+    }
+}
+
+#ifdef PCBASIC_TARGET
+static void pin_changed(int pin, int level)
+{
+    int i;
+
+    for (i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (pin_watch[i].pin == pin && (pin_watch[i].mode & (level ? PIN_EVENT_RISING : PIN_EVENT_FALLING)))
+        {
+            pin_event(i);
+        }
+    }
+}
+
+/* There are no pins on a PC, so writes are looped back to reads and raise
+   the same events a real edge would */
+static uint8_t sim_pin_level[PIN_COUNT];
+
 void host_digitalWrite(int pin, int state)
 {
-    /* TODO */
-    pin = pin;
-    state = state;
+    if (pin < 0 || pin >= PIN_COUNT)
+        return;
+    state = state ? 1 : 0;
+    if (sim_pin_level[pin] != state)
+    {
+        sim_pin_level[pin] = state;
+        pin_changed(pin, state);
+    }
 }
 
 int host_digitalRead(int pin)
+{
+    if (pin < 0 || pin >= PIN_COUNT)
+        return 0;
+    return sim_pin_level[pin];
+}
+
+void host_pinMode(int pin,int mode)
 {
     pin = pin;
-    return 0;       /* TODO*/
+    mode = mode;
+}
+#else
+static const uint32_t pin_gpio[PIN_PORTS] = { GPIOA, GPIOB, GPIOC };
+
+void host_digitalWrite(int pin, int state)
+{
+    if (pin < 0 || pin >= PIN_COUNT)
+        return;
+    /* BSRR sets the low 16 bits and clears the high 16 in one write */
+    GPIO_BSRR(pin_gpio[pin / 16]) = (1UL << (pin % 16)) << (state ? 0 : 16);
+}
+
+int host_digitalRead(int pin)
+{
+    if (pin < 0 || pin >= PIN_COUNT)
+        return 0;
+    return (GPIO_IDR(pin_gpio[pin / 16]) >> (pin % 16)) & 1;
+}
+
+/* 0 = input, 1 = output, 2 = input with pull up, as Arduino's pinMode() */
+void host_pinMode(int pin, int mode)
+{
+    uint32_t port;
+    uint16_t bit;
+
+    if (pin < 0 || pin >= PIN_COUNT)
+        return;
+    port = pin_gpio[pin / 16];
+    bit = 1 << (pin % 16);
+    if (mode == 1)
+    {
+        gpio_set_mode(port, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, bit);
+    }
+    else if (mode == 2)
+    {
+        gpio_set_mode(port, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN, bit);
+        gpio_set(port, bit);        /* ODR picks up rather than down */
+    }
+    else
+    {
+        gpio_set_mode(port, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, bit);
+    }
+}
+
+/*
+ * Pin n raises EXTI line n % 16, and a line can only be connected to one
+ * port at a time, so PA3 and PB3 can't both be watched. The trigger is set
+ * to just the edges wanted, so every interrupt is queued as it is.
+ */
+static void exti_lines_changed(uint32_t lines)
+{
+    uint32_t pending = EXTI_PR & lines;
+    int i;
+
+    exti_reset_request(pending);
+    for (i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (pin_watch[i].mode != PIN_EVENT_OFF && (pending & (1UL << (pin_watch[i].pin % 16))))
+        {
+            pin_event(i);
+        }
+    }
+}
+
+void exti0_isr(void)
+{
+    exti_lines_changed(EXTI0);
 }
 
+void exti1_isr(void)
+{
+    exti_lines_changed(EXTI1);
+}
+
+void exti2_isr(void)
+{
+    exti_lines_changed(EXTI2);
+}
+
+void exti3_isr(void)
+{
+    exti_lines_changed(EXTI3);
+}
+
+void exti4_isr(void)
+{
+    exti_lines_changed(EXTI4);
+}
+
+void exti9_5_isr(void)
+{
+    exti_lines_changed(0x03E0);     /* EXTI5 to EXTI9 */
+}
+
+void exti15_10_isr(void)
+{
+    exti_lines_changed(0xFC00);     /* EXTI10 to EXTI15 */
+}
+
+static void exti_watch(int pin, int mode)
+{
+    int line = pin % 16;
+    uint32_t exti = 1UL << line;
+
+    if (mode == PIN_EVENT_OFF)
+    {
+        exti_disable_request(exti);
+        return;
+    }
+
+    exti_select_source(exti, pin_gpio[pin / 16]);
+    exti_set_trigger(exti, mode == PIN_EVENT_RISING ? EXTI_TRIGGER_RISING :
+        mode == PIN_EVENT_FALLING ? EXTI_TRIGGER_FALLING : EXTI_TRIGGER_BOTH);
+    exti_reset_request(exti);       /* Forget edges from before */
+    exti_enable_request(exti);
+    if (line < 5)
+        nvic_enable_irq(NVIC_EXTI0_IRQ + line);
+    else
+        nvic_enable_irq(line < 10 ? NVIC_EXTI9_5_IRQ : NVIC_EXTI15_10_IRQ);
+}
+#endif
+
+#ifdef PCBASIC_TARGET
 int host_analogRead(int pin)
 {
     pin = pin;
-    return 0;       /* TODO */
+    return 0;
 }
+#else
+static bool sampling;
 
-void host_pinMode(int pin,int mode)
+/* The ADC channel on pin, or -1 if it has none */
+static int adc_channel(int pin)
 {
-    /* TODO */
-    pin = pin;
-    mode = mode;
+    if (pin >= 0 && pin < 8)
+        return pin;                 /* PA0-PA7 */
+    if (pin == 16 || pin == 17)
+        return pin - 8;             /* PB0-PB1 */
+    return -1;
+}
+
+static void adc_pin(int pin)
+{
+    gpio_set_mode(pin_gpio[pin / 16], GPIO_MODE_INPUT, GPIO_CNF_INPUT_ANALOG, 1 << (pin % 16));
+}
+
+/* 0-1023 as on the Arduino, so programs carry across. The ADC belongs to
+   SAMPLE while it is capturing. */
+int host_analogRead(int pin)
+{
+    uint8_t channel[1];
+
+    if (adc_channel(pin) < 0 || sampling)
+        return 0;
+    adc_pin(pin);
+    channel[0] = adc_channel(pin);
+    adc_set_regular_sequence(ADC1, 1, channel);
+    adc_start_conversion_direct(ADC1);
+    while (!adc_eoc(ADC1));
+    return adc_read_regular(ADC1) >> 2;
+}
+#endif
+
+/* Queue the edges in mode (PIN_EVENT_OFF stops watching). Returns false if
+   the pin can't be watched or all the slots are in use. */
+bool host_watch_pin(int pin, int mode)
+{
+    int i, slot = -1;
+
+    if (pin < 0 || pin >= PIN_COUNT)
+        return false;
+    for (i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (pin_watch[i].mode != PIN_EVENT_OFF && pin_watch[i].pin == pin)
+        {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && pin_watch[i].mode == PIN_EVENT_OFF)
+            slot = i;
+    }
+    if (slot < 0)
+        return mode == PIN_EVENT_OFF;
+#ifndef PCBASIC_TARGET
+    for (i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (mode != PIN_EVENT_OFF && pin_watch[i].mode != PIN_EVENT_OFF &&
+            pin_watch[i].pin != pin && pin_watch[i].pin % 16 == pin % 16)
+            return false;   /* Its EXTI line is taken */
+    }
+#endif
+    if (pin_watch[slot].mode == PIN_EVENT_OFF)
+    {
+        if (mode == PIN_EVENT_OFF)
+            return true;
+        pin_watch[slot].pin = pin;
+        pin_watch[slot].dropped = 0;
+    }
+    pin_watch[slot].mode = mode;
+#ifndef PCBASIC_TARGET
+    exti_watch(pin, mode);
+#endif
+    return true;
+}
+
+/* The next queued pin, or -1 if none */
+int host_get_pin_event(void)
+{
+    int pin;
+
+    if (pin_event_head == pin_event_tail)
+        return -1;
+    pin = pin_event_buf[pin_event_tail & (PIN_EVENT_QUEUE - 1)];
+    pin_event_tail++;
+    return pin;
+}
+
+unsigned int host_pin_events_dropped(int pin)
+{
+    int i;
+
+    for (i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (pin_watch[i].mode != PIN_EVENT_OFF && pin_watch[i].pin == pin)
+            return pin_watch[i].dropped;
+    }
+    return 0;
+}
+
+static bool sample_lost;
+
+#ifdef PCBASIC_TARGET
+/* SAMPLE on a PC reads a made up vibration, 50Hz with some 180Hz on top,
+   at the times the readings would have been taken. Readings that would have
+   overflowed a SAMPLE_QUEUE on real hardware are lost the same way. */
+static long long host_input_us(void);
+static uint32_t sample_rate;            /* 0 = not sampling */
+static long long sample_start_us;
+static uint32_t sample_taken;
+
+bool host_start_sampling(int pin, uint32_t rate)
+{
+    if (pin < 0 || pin >= PIN_COUNT || rate < 1 || rate > SAMPLE_RATE_MAX)
+    {
+        return false;
+    }
+
+    sample_rate = rate;
+    sample_start_us = host_input_us();
+    sample_taken = 0;
+    sample_lost = false;
+    return true;
+}
+
+void host_stop_sampling(void)
+{
+    sample_rate = 0;
+}
+
+/* The readings taken by now. If more are waiting than the queue holds,
+   the newest were dropped, as the hardware would drop them. */
+static uint32_t sample_due(void)
+{
+    uint32_t due = (uint32_t)((host_input_us() - sample_start_us) * sample_rate / 1000000);
+
+    if (due - sample_taken > SAMPLE_QUEUE)
+    {
+        sample_lost = true;
+    }
+
+    return due;
+}
+
+/* The next reading, or -1 if there isn't one yet */
+int host_get_sample(void)
+{
+    float t;
+
+    if (!sample_rate || sample_taken == sample_due())
+    {
+        return -1;
+    }
+
+    t = (float)sample_taken++ / sample_rate;
+    return (int)(512.0f + 300.0f * sinf(2 * 3.14159265f * 50 * t) + 80.0f * sinf(2 * 3.14159265f * 180 * t));
 }
+#else
+/*
+ * TIM3 triggers a conversion every 1/rate s, and DMA1 channel 1 copies each
+ * one into sample_buf, round and round. The DMA interrupt counts the laps,
+ * so the readings written can be counted, and a lap that overwrote
+ * readings not taken yet shows up as more than SAMPLE_QUEUE waiting.
+ */
+static volatile uint16_t sample_buf[SAMPLE_QUEUE];
+static volatile uint32_t sample_laps;
+static uint32_t sample_taken;
+
+void dma1_channel1_isr(void)
+{
+    if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_TCIF))
+    {
+        dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_TCIF);
+        sample_laps++;
+    }
+}
+
+/* Readings written since sampling started */
+static uint32_t sample_written(void)
+{
+    uint32_t laps, left;
+
+    cm_disable_interrupts();
+    laps = sample_laps;
+    left = DMA_CNDTR(DMA1, DMA_CHANNEL1);
+    if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_TCIF))
+    {
+        /* Wrapped, but the interrupt hasn't counted the lap yet */
+        laps++;
+        left = DMA_CNDTR(DMA1, DMA_CHANNEL1);
+    }
+    cm_enable_interrupts();
+
+    return laps * SAMPLE_QUEUE + SAMPLE_QUEUE - left;
+}
+
+bool host_start_sampling(int pin, uint32_t rate)
+{
+    uint8_t channel[1];
+
+    if (adc_channel(pin) < 0 || rate < 1 || rate > SAMPLE_RATE_MAX)
+    {
+        return false;
+    }
+
+    host_stop_sampling();
+    adc_pin(pin);
+    channel[0] = adc_channel(pin);
+    adc_set_regular_sequence(ADC1, 1, channel);
+
+    rcc_periph_clock_enable(RCC_DMA1);
+    dma_channel_reset(DMA1, DMA_CHANNEL1);
+    dma_set_peripheral_address(DMA1, DMA_CHANNEL1, (uint32_t)&ADC_DR(ADC1));
+    dma_set_memory_address(DMA1, DMA_CHANNEL1, (uint32_t)sample_buf);
+    dma_set_number_of_data(DMA1, DMA_CHANNEL1, SAMPLE_QUEUE);
+    dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
+    dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
+    dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
+    dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_16BIT);
+    dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+    dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1);
+    nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+
+    sample_laps = 0;
+    sample_taken = 0;
+    sample_lost = false;
+    sampling = true;
+    dma_enable_channel(DMA1, DMA_CHANNEL1);
+    adc_enable_dma(ADC1);
+    adc_enable_external_trigger_regular(ADC1, ADC_CR2_EXTSEL_TIM3_TRGO);
+    timer3_trigger_setup(rate);
+    return true;
+}
+
+void host_stop_sampling(void)
+{
+    if (!sampling)
+    {
+        return;
+    }
+
+    timer_disable_counter(TIM3);
+    adc_disable_external_trigger_regular(ADC1);
+    adc_disable_dma(ADC1);
+    dma_disable_channel(DMA1, DMA_CHANNEL1);
+    sampling = false;
+}
+
+/* The next reading, or -1 if there isn't one yet */
+int host_get_sample(void)
+{
+    int reading;
+
+    if (!sampling || sample_written() == sample_taken)
+    {
+        return -1;
+    }
+
+    reading = sample_buf[sample_taken % SAMPLE_QUEUE] >> 2;
+    if (sample_written() - sample_taken > SAMPLE_QUEUE)
+    {
+        sample_lost = true;     /* Written over before it was read */
+    }
+    sample_taken++;
+
+    return reading;
+}
+#endif
+
+/* Readings were lost because the queue was full */
+bool host_samples_lost(void)
+{
+#ifdef PCBASIC_TARGET
+    if (sample_rate)
+    {
+        sample_due();
+    }
+#else
+    if (sampling && sample_written() - sample_taken > SAMPLE_QUEUE)
+    {
+        sample_lost = true;
+    }
+#endif
+    return sample_lost;
+}
+
+/* Clocks out count bytes, LSB first if bitOrder is 0 (as Arduino's LSBFIRST) */
+bool host_shift_out(int dataPin, int clockPin, int bitOrder, float *values, int count)
+{
+    int i, bit;
+
+    if (dataPin < 0 || dataPin >= PIN_COUNT || clockPin < 0 || clockPin >= PIN_COUNT)
+    {
+        return false;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        uint8_t val = (uint8_t)(int)values[i];
+
+        for (bit = 0; bit < 8; bit++)
+        {
+            int high;
+
+            if (bitOrder == 0)
+            {
+                high = val & 1;
+                val >>= 1;
+            }
+            else
+            {
+                high = val & 0x80;
+                val <<= 1;
+            }
+
+#ifdef PCBASIC_TARGET
+            host_digitalWrite(dataPin, high);
+            host_digitalWrite(clockPin, 1);
+            host_digitalWrite(clockPin, 0);
+#else
+            GPIO_BSRR(pin_gpio[dataPin / 16]) = (1UL << (dataPin % 16)) << (high ? 0 : 16);
+            GPIO_BSRR(pin_gpio[clockPin / 16]) = 1UL << (clockPin % 16);
+            GPIO_BSRR(pin_gpio[clockPin / 16]) = (1UL << (clockPin % 16)) << 16;
+#endif
+        }
+    }
+
+    return true;
+}
+
+#ifdef PCBASIC_TARGET
+/* Port n is simulated pins n*16 to n*16+15. The pins are written one at a
+   time through host_digitalWrite(), so ON PIN sees every edge. */
+bool host_port_out(int port, int mask, int value)
+{
+    int bit;
+
+    if (port < 0 || port >= PIN_PORTS)
+    {
+        return false;
+    }
+
+    for (bit = 0; bit < 16; bit++)
+    {
+        if (mask & (1 << bit))
+        {
+            host_digitalWrite(port * 16 + bit, value & (1 << bit));
+        }
+    }
+
+    return true;
+}
+
+/* All the pins of port as bits, or -1 if there is no such port */
+int host_port_in(int port)
+{
+    int bit, value = 0;
+
+    if (port < 0 || port >= PIN_PORTS)
+    {
+        return -1;
+    }
+
+    for (bit = 0; bit < 16; bit++)
+    {
+        value |= sim_pin_level[port * 16 + bit] << bit;
+    }
+
+    return value;
+}
+#else
+/* Port 0 is GPIOA, 1 GPIOB and 2 GPIOC. BSRR sets and clears the pins in
+   mask with one write, so they all change together. */
+bool host_port_out(int port, int mask, int value)
+{
+    if (port < 0 || port >= PIN_PORTS)
+    {
+        return false;
+    }
+
+    mask &= 0xFFFF;
+    GPIO_BSRR(pin_gpio[port]) = (mask & value) | (uint32_t)(mask & ~value) << 16;
+
+    return true;
+}
+
+/* All the pins of port as bits, or -1 if there is no such port */
+int host_port_in(int port)
+{
+    if (port < 0 || port >= PIN_PORTS)
+    {
+        return -1;
+    }
+
+    return GPIO_IDR(pin_gpio[port]) & 0xFFFF;
+}
+#endif
 
 #ifdef BUZZER_IN_USE
 void host_click()
@@ -361,6 +1072,13 @@ void host_showBuffer()
             lineDirty[y] = 0;
         }
     }
+
+#ifdef PCBASIC_TARGET
+#ifndef WIN32
+    fflush(stdout);
+#endif
+    host_input_echoed();
+#endif
 }
 
 void scroll_buffer(void)
@@ -417,76 +1135,324 @@ void host_output_char(char c)
     curY = pos / SCREEN_WIDTH;
 }
 
+/* Writes the digits of n backwards from end, returns the first digit */
+static char *uint_to_str(uint32_t n, char *end)
+{
+    do
+    {
+        *--end = (char)(n % 10) + '0';
+        n /= 10;
+    }
+    while (n);
+
+    return end;
+}
+
 int host_output_int(long num)
 {
     /* Returns len */
-    long i = num, xx = 1;
-    int c = 0;
-    do {
-        c++;
-        xx *= 10;
-        i /= 10;
+    char buf[12];
+    char *p = uint_to_str(num < 0 ? -(uint32_t)num : (uint32_t)num, buf + sizeof(buf) - 1);
+
+    if (num < 0)
+    {
+        *--p = '-';
     }
-    while (i);
+    buf[sizeof(buf) - 1] = 0;
+    host_output_string(p);
+
+    return buf + sizeof(buf) - 1 - p;
+}
+
+/* 10^r and 10^16j as 32 bit significands, see pow10_significand() */
+static const uint32_t pow10_small[16] =
+{
+    0x80000000, 0xA0000000, 0xC8000000, 0xFA000000, 0x9C400000, 0xC3500000, 0xF4240000, 0x98968000,
+    0xBEBC2000, 0xEE6B2800, 0x9502F900, 0xBA43B740, 0xE8D4A510, 0x9184E72A, 0xB5E620F4, 0xE35FA932
+};
+static const uint32_t pow10_big[8] =
+{
+    0xA87FEA28, 0xBB127C54, 0xCFB11EAD, 0xE69594BF, 0x80000000, 0x8E1BC9BF, 0x9DC5ADA8, 0xAF298D05
+};
+
+/*
+ * 10^s ~= significand * 2^exp2, with the significand in [2^31, 2^32).
+ * Exact for 0 <= s <= 13, otherwise within a unit in the last place.
+ * Good for -64 <= s < 64.
+ */
+static uint32_t pow10_significand(int32_t s, int32_t *exp2)
+{
+    int32_t j = (s + 64) / 16 - 4;
+    uint32_t p = pow10_small[s - 16 * j];
 
-    for (int z = 0; z < c; z++)
+    if (j)
     {
-        xx /= 10;
-        char digit = ((num/xx) % 10) + '0';
-        host_output_char(digit);
+        uint64_t prod = (uint64_t)p * pow10_big[j + 4];
+        p = (prod >> 63) ? (prod + 0x80000000UL) >> 32 : (prod + 0x40000000UL) >> 31;
     }
+    /* floor(s * log2(10)) */
+    *exp2 = (int32_t)((s * 217706L) >> 16) - 31;
+
+    return p;
+}
+
+/* m * 2^e2 * 10^s rounded to an integer, which must be less than 2^31 */
+static uint32_t round_scaled(uint32_t m, int32_t e2, int32_t s)
+{
+    int32_t pe;
+    uint64_t prod = (uint64_t)m * pow10_significand(s, &pe);
+    int32_t shift = -(e2 + pe);
 
-    return c;
+    return (uint32_t)(((prod >> (shift - 1)) + 1) >> 1);
 }
 
+/*
+ * Formats f with up to 7 significant digits, trailing zeros removed. Numbers
+ * from 0.0001 to 9999999 are printed in full, others as e.g. -1.234567e-12,
+ * so buf needs 14 characters. The digits come from the bits of the float
+ * using integer arithmetic rather than float divisions, so the last one is
+ * within one unit of the correctly rounded digit, and only off at all when
+ * the value is very nearly halfway between two.
+ */
 char *host_float_to_str(float f, char *buf)
 {
-    /* Floats have approx 7 sig figs */
-    float a = (double)fabs(f);
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    int32_t e2 = (bits >> 23) & 0xFF;
+    uint32_t m = bits & 0x7FFFFF;
+    char *p = buf;
+    char digits[8];
+    int32_t exp10, last;
+    uint32_t d;
+
+    if (e2 == 0 && m == 0)
+    {
+        strcpy(buf, "0");
+        return buf;
+    }
 
-    if (f == 0.0f)
+    if (bits & 0x80000000UL)
     {
-        buf[0] = '0';
-        buf[1] = 0;
+        *p++ = '-';
     }
-    else if (a < 0.0001 || a > 1000000)
+
+    if (e2 == 0xFF)
     {
-#if 1 /* TODO */
-        sprintf(buf, "%f", f);
-#else
-        /* This will output -1.123456E99 = 13 characters max including trailing nul */
-        dtostre(f, buf, 6, 0);
-#endif
+        strcpy(p, m ? "nan" : "inf");
+        return buf;
+    }
+
+    /* f = m * 2^e2 with m normalised to 24 bits */
+    if (e2)
+    {
+        m |= 0x800000;
     }
     else
     {
-        int decPos = 7 - (int)(floor(log10(a))+1.0f);
+        e2 = 1;
+    }
+    e2 -= 150;
+    while (!(m & 0x800000))
+    {
+        m <<= 1;
+        e2--;
+    }
 
-#if 1 /* TODO */
-        sprintf(buf, "%f", f);
-#else
-        dtostrf(f, 1, decPos, buf);
-#endif
+    /* Decimal exponent, from floor(log10(2^(e2+23))) - which can be one low */
+    exp10 = (int32_t)(((e2 + 23) * 78913L) >> 18);
+    d = round_scaled(m, e2, 6 - exp10);
+    if (d >= 10000000UL)
+    {
+        exp10++;
+        d = round_scaled(m, e2, 6 - exp10);
+    }
+    uint_to_str(d, digits + 7);
+    last = 6;
+    while (digits[last] == '0')
+    {
+        last--;
+    }
 
-        if (decPos)
+    if (exp10 >= -4 && exp10 <= 6)
+    {
+        int32_t i = 0;
+
+        if (exp10 < 0)
         {
-            /* Remove trailing 0s */
-            char *p = buf;
-            while (*p) p++;
-            p--;
-            while (*p == '0')
+            *p++ = '0';
+            *p++ = '.';
+            for (int32_t z = -1; z > exp10; z--)
             {
-                *p-- = 0;
+                *p++ = '0';
             }
-
-            if (*p == '.')
-                *p = 0;
         }
+        else
+        {
+            while (i <= exp10)
+            {
+                *p++ = digits[i++];
+            }
+            if (i <= last)
+            {
+                *p++ = '.';
+            }
+        }
+        while (i <= last)
+        {
+            *p++ = digits[i++];
+        }
+    }
+    else
+    {
+        *p++ = digits[0];
+        if (last)
+        {
+            *p++ = '.';
+            for (int32_t i = 1; i <= last; i++)
+            {
+                *p++ = digits[i];
+            }
+        }
+        *p++ = 'e';
+        *p++ = exp10 < 0 ? '-' : '+';
+        if (exp10 < 0)
+        {
+            exp10 = -exp10;
+        }
+        *p++ = exp10 / 10 + '0';
+        *p++ = exp10 % 10 + '0';
     }
+    *p = 0;
 
     return buf;
 }
 
+/*
+ * Reads a decimal number with optional sign, fraction and exponent, e.g.
+ * -12.5e3, like strtod. Up to 9 significant digits are used, and the result
+ * is within a unit in the last place - nearly always the correctly rounded
+ * float. If end isn't 0 it is set to the first character after the number,
+ * or to str if there wasn't one.
+ */
+float host_str_to_float(const char *str, const char **end)
+{
+    const char *p = str;
+    uint32_t m = 0;
+    int32_t digits = 0, exp10 = 0;
+    bool neg = false, got_digit = false;
+    float f;
+
+    while (isspace((unsigned char)*p))
+    {
+        p++;
+    }
+    if (*p == '-' || *p == '+')
+    {
+        neg = (*p++ == '-');
+    }
+    for (; isdigit((unsigned char)*p); p++)
+    {
+        got_digit = true;
+        if (digits < 9)
+        {
+            m = m * 10 + (*p - '0');
+            if (m)
+            {
+                digits++;
+            }
+        }
+        else
+        {
+            exp10++;
+        }
+    }
+    if (*p == '.')
+    {
+        for (p++; isdigit((unsigned char)*p); p++)
+        {
+            got_digit = true;
+            if (digits < 9)
+            {
+                m = m * 10 + (*p - '0');
+                if (m)
+                {
+                    digits++;
+                }
+                exp10--;
+            }
+        }
+    }
+
+    if (!got_digit)
+    {
+        if (end)
+        {
+            *end = str;
+        }
+        return 0.0f;
+    }
+
+    /* Only take an exponent if there are digits after the e */
+    if (*p == 'e' || *p == 'E')
+    {
+        const char *q = p + 1;
+        bool exp_neg = false;
+
+        if (*q == '-' || *q == '+')
+        {
+            exp_neg = (*q++ == '-');
+        }
+        if (isdigit((unsigned char)*q))
+        {
+            int32_t e = 0;
+
+            for (; isdigit((unsigned char)*q); q++)
+            {
+                if (e < 1000)
+                {
+                    e = e * 10 + (*q - '0');
+                }
+            }
+            exp10 += exp_neg ? -e : e;
+            p = q;
+        }
+    }
+    if (end)
+    {
+        *end = p;
+    }
+
+    if (m == 0 || exp10 < -54)
+    {
+        f = 0.0f;
+    }
+    else if (exp10 > 38)
+    {
+        f = INFINITY;
+    }
+    else
+    {
+        /*
+         * m * 10^exp10 = m * significand * 2^exp2, rounded to 24 bits by the
+         * conversion to float. Bits below the top 32 are kept as a sticky bit.
+         */
+        int32_t exp2, shift = 0;
+        uint64_t prod;
+        uint32_t top;
+
+        while (!(m & 0x80000000UL))
+        {
+            m <<= 1;
+            shift++;
+        }
+        prod = (uint64_t)m * pow10_significand(exp10, &exp2);
+        top = (uint32_t)(prod >> 32) | ((uint32_t)prod != 0);
+        f = ldexpf((float)top, exp2 + 32 - shift);
+    }
+
+    return neg ? -f : f;
+}
+
 void host_output_float(float f)
 {
     char buf[16];
@@ -521,7 +1487,9 @@ char *host_readLine()
     while (!done)
     {
 #ifdef KEYPAD_8x5_IN_USE
-        if(key_not_printed && key_pressed)
+        char c = get_key();
+
+        if (c != 0)
 #endif
         {
 #ifdef BUZZER_IN_USE
@@ -532,26 +1500,18 @@ char *host_readLine()
 
 #ifndef PCBASIC_TARGET
 #ifdef KEYPAD_8x5_IN_USE
-            char c = get_key();
-
-            if(c != 0)
-            {
-                key_not_printed = false;
-                keypress_timeout_counter = 0;
-
-                if (c >= 32 && c <= 126)
-                    screenBuffer[pos++] = c;
-                else if (c == KEY_DELETE && pos > startPos)
-                    screenBuffer[--pos] = 0;
-                else if (c == KEY_ENTER)
-                    done = true;
+            if (c >= 32 && c <= 126)
+                screenBuffer[pos++] = c;
+            else if (c == KEY_DELETE && pos > startPos)
+                screenBuffer[--pos] = 0;
+            else if (c == KEY_ENTER)
+                done = true;
 
-                redraw = 1;
-            }
+            redraw = 1;
 #endif /* KEYPAD_8x5_IN_USE */
 #else
 #ifdef WIN32
-            char c = (char)getch();
+            char c = (char)host_input_key(true);
 
             if (c >= 32 && c <= 126)
             {
@@ -572,8 +1532,10 @@ char *host_readLine()
                 cur_x = 1;
                 done = true;
             }
+
+            host_input_echoed();
 #else
-            char c = lingetch();
+            char c = (char)host_input_key(true);
 
             if (c >= 32 && c <= 126)
             {
@@ -596,6 +1558,7 @@ char *host_readLine()
             }
 
             fflush(stdout);
+            host_input_echoed();
 #endif /* WIN32 */
 #endif /* PCBASIC_TARGET */
 
@@ -635,8 +1598,14 @@ char *host_readLine()
 
 char host_getKey()
 {
+#ifdef KEYPAD_8x5_IN_USE
+    char c = get_key();
+#elif defined(PCBASIC_TARGET)
+    int c = host_input_key(false);
+#else
     char c = inkeyChar;
     inkeyChar = 0;
+#endif
 
     if (c >= 32 && c <= 126)
         return c;
@@ -646,7 +1615,19 @@ char host_getKey()
 
 uint8_t host_esc_pressed()
 {
+#ifdef PCBASIC_TARGET
+    int c = host_input_key(false);
+
+    if (c == CHAR_ESC)
+        return true;
+
+    if (c >= 0)
+        pendingKey = c;         /* Keep it for INKEY$ or INPUT */
+
+    return false;
+#else
     return false; /* TODO */
+#endif
 }
 
 void host_outputFreeMem(unsigned int val)
@@ -726,144 +1707,228 @@ char lingetch(void)
     /* printf("%c\n",buf); */
     return buf;
 }
+
+int lingetch_nowait(void)
+{
+    /* As lingetch(), but returns -1 at once if no key has been typed */
+    char buf = 0;
+    int n;
+    struct termios old = {0};
+
+    if(tcgetattr(0, &old) < 0)
+    {
+        return -1;
+    }
+
+    old.c_lflag &=~ ICANON;
+    old.c_lflag &=~ ECHO;
+    old.c_cc[VMIN] = 0;
+    old.c_cc[VTIME] = 0;
+    tcsetattr(0, TCSANOW, &old);
+
+    n = read(0, &buf, 1);
+
+    old.c_lflag |= ICANON;
+    old.c_lflag |= ECHO;
+    tcsetattr(0, TCSADRAIN, &old);
+
+    return n == 1 ? buf : -1;
+}
 #endif /* WIN32 */
-#endif /* PCBASIC_TARGET */
 
-#ifndef PCBASIC_TARGET
-#ifdef KEYPAD_8x5_IN_USE
-void state_machine_init()
+static long long host_input_us(void)
 {
-    value_ROW = 1;
-    key_check_state_machine = E_set_row_1st;
+#ifdef WIN32
+    return (long long)GetTickCount() * 1000;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
 }
 
-void state_machine_set_row_1st()
+static int cmp_long(const void *a, const void *b)
 {
-    set_KBD2(value_ROW);
-    key_check_state_machine = E_read_col_1st;
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
 }
 
-void state_machine_read_column_1st()
+static void replay_report(void)
 {
-    COLs_array[value_ROW - 1] = read_KBD1();
-    value_ROW++;
+    long long sum = 0;
+    int i;
 
-    if (value_ROW > ROWS)
+    if (latencyCount == 0)
     {
-        value_ROW = 1;
-        key_check_state_machine = E_set_row_2nd;
+        fprintf(stderr, "replay: no keys echoed\n");
+        return;
     }
-    else
-    {
-        key_check_state_machine = E_set_row_1st;
-    }
-}
 
-void state_machine_set_row_2nd()
-{
-    set_KBD2(value_ROW);
-    key_check_state_machine = E_read_col_2nd;
+    qsort(latencyUs, latencyCount, sizeof(latencyUs[0]), cmp_long);
+    for (i = 0; i < latencyCount; i++)
+        sum += latencyUs[i];
+
+    fprintf(stderr, "replay: %d keys, echo latency us: mean %lld, median %ld, 95%% %ld, max %ld\n",
+            latencyCount, sum / latencyCount,
+            latencyUs[latencyCount / 2],
+            latencyUs[latencyCount * 95 / 100],
+            latencyUs[latencyCount - 1]);
 }
 
-void state_machine_read_column_2nd()
+/* Reads the next line of keys. Returns false at the end of the file */
+static bool replay_next_line(void)
 {
-    uint8_t i, col_value;
+    char line[300];
+    char *p;
 
-    col_value = read_KBD1();
-
-    if(col_value != COLs_array[value_ROW - 1])          // Contact bounce -> start again
-    {
-        state_machine_init();
-    }
-    else
+    while (fgets(line, sizeof(line), replayFile))
     {
-        value_ROW++;
-        if (value_ROW > ROWS)                      // Done (cycle) -> analyse keyboard array
+        if (line[0] == '#' || sscanf(line, "%ld", &replayDueMs) != 1)
+            continue;
+
+        p = line;
+        while (*p >= '0' && *p <= '9')
+            p++;
+        if (*p == ' ')
+            p++;
+
+        replayLen = 0;
+        replayPos = 0;
+        while (*p && *p != '\n' && *p != '\r' && replayLen < (int)sizeof(replayKeys))
         {
-            for(i = 0; i < ROWS; i++)
+            char c = *p++;
+
+            if (c == '\\' && *p)
             {
-                if(key_pressed == false)
+                switch (*p++)
                 {
-                    if(COLs_array[i] != 0)          // A key was pressed
-                    {
-                        key_pressed = true;
-                        break;
-                    }
+                    case 'n':   c = CHAR_CR;        break;
+                    case 'b':   c = CHAR_DELETE;    break;
+                    case 'e':   c = CHAR_ESC;       break;
+                    default:    c = p[-1];          break;
                 }
             }
 
-            state_machine_init();
-        }
-        else
-        {
-            key_check_state_machine = E_set_row_2nd;
+            replayKeys[replayLen++] = c;
         }
+
+        if (replayLen)
+            return true;
     }
+
+    return false;
 }
 
-char get_key()
+static int replay_key(bool wait)
 {
-    bool shift_pressed = false;
-    bool other_keys_pressed = false;
-    bool key_ready = false;
-    int i, col, row;
-    char key = 0;
+    long long due;
 
-    for(i = 0; i < ROWS; i++)
+    if (replayPos == replayLen && !replay_next_line())
     {
-        if (COLs_array[i] != 0)
-        {
-            if ((i == 5) && (COLs_array[i] == 1))
-            {
-                shift_pressed = true;
-            }
-            // Ugly workaround. TODO
-            else if ((i == 5) && (COLs_array[i] == 3))
-            {
-                key = ':';
-                key_ready = true;
-                break;
-            }
-            else if ((i == 5) && (COLs_array[i] == 5))
-            {
-                key = ';';
-                key_ready = true;
-                break;
-            }
-            else if ((i == 5) && (COLs_array[i] == 9))
-            {
-                key = '?';
-                key_ready = true;
-                break;
-            }
-            else if ((i == 5) && (COLs_array[i] == 17))
-            {
-                key = '/';
-                key_ready = true;
-                break;
-            }
-            else
-            {
-                other_keys_pressed = true;
-                row = i;
-                col = COLs_array[i] - 1;
-            }
-        }
+        if (!wait)
+            return -1;
+
+        /* Nothing left to type, so show what the last line printed */
+        host_showBuffer();
+        fflush(stdout);
+        replay_report();
+        exit(0);
     }
 
-    if(!key_ready)
+    due = replayStartUs + (long long)replayDueMs * 1000;
+    if (host_input_us() < due)
     {
-        if(other_keys_pressed)
-        {
-            if(shift_pressed)
-            {
-                key = key_map_shift[row][col];
-            }
-            else
-            {
-                 key = key_map[row][col];
-            }
-        }
+        if (!wait)
+            return -1;
+
+        host_sleep((long)((due - host_input_us() + 999) / 1000));
+    }
+
+    if ((uint8_t)(echoHead - echoTail) < sizeof(echoDueUs) / sizeof(echoDueUs[0]))
+        echoDueUs[echoHead++ % (sizeof(echoDueUs) / sizeof(echoDueUs[0]))] = due;
+
+    return (unsigned char)replayKeys[replayPos++];
+}
+
+bool host_input_replay(const char *fileName)
+{
+    if (strcmp(fileName, "-") == 0)
+        replayFile = stdin;
+    else
+        replayFile = fopen(fileName, "r");
+
+    if (replayFile == NULL)
+        return false;
+
+    replayStartUs = host_input_us();
+    return true;
+}
+
+/* Next key, or -1 if wait is false and there isn't one yet */
+int host_input_key(bool wait)
+{
+    int c;
+
+    if (pendingKey >= 0)
+    {
+        c = pendingKey;
+        pendingKey = -1;
+        return c;
+    }
+
+    if (replayFile)
+        return replay_key(wait);
+
+    if (wait)
+    {
+#ifdef WIN32
+        return getch();
+#else
+        return (unsigned char)lingetch();
+#endif
+    }
+
+    /* Polling the console is slow, so don't do it on every statement */
+    if (host_input_us() - lastPollUs < KEY_POLL_INTERVAL * 1000)
+        return -1;
+
+    lastPollUs = host_input_us();
+#ifdef WIN32
+    return kbhit() ? getch() : -1;
+#else
+    return lingetch_nowait();
+#endif
+}
+
+/* The screen has been updated: every key read so far has been echoed */
+void host_input_echoed(void)
+{
+    long long now;
+
+    if (echoHead == echoTail)
+        return;
+
+    now = host_input_us();
+    while (echoTail != echoHead)
+    {
+        long long due = echoDueUs[echoTail++ % (sizeof(echoDueUs) / sizeof(echoDueUs[0]))];
+
+        if (latencyCount < REPLAY_MAX_KEYS)
+            latencyUs[latencyCount++] = (long)(now - due);
+    }
+}
+#endif /* PCBASIC_TARGET */
+
+#ifndef PCBASIC_TARGET
+#ifdef KEYPAD_8x5_IN_USE
+char get_key()
+{
+    char key = 0;
+
+    if (kbd_tail != kbd_head)
+    {
+        key = kbd_buf[kbd_tail & (KBD_BUF_SIZE - 1)];
+        kbd_tail++;
     }
 
     return key;
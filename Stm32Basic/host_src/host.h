@@ -45,6 +45,8 @@
 #define CHAR_DELETE                             127
 #endif /* WIN32 */
 #define CHAR_ESC                                27
+#define KEY_POLL_INTERVAL                       20      /* ms between console polls while running */
+#define REPLAY_MAX_KEYS                         4096    /* Echo latencies kept for the report */
 #endif
 
 #ifdef KEYPAD_8x5_IN_USE
@@ -53,8 +55,13 @@
 #define KEY_DELETE                              127
 #define ROWS                                    8
 #define COLS                                    16
-#define TIMER2_PERIOD                           180     /* Microseconds */
-#define KEYPRESS_TIMEOUT                        1000
+#define KBD_LINES                               5       /* Inputs read per row */
+#define TIMER2_PERIOD                           2000    /* Microseconds, one whole keyboard scan */
+#define KBD_SETTLE_LOOPS                        50      /* After driving a row, before reading it */
+#define KBD_DEBOUNCE_SCANS                      3       /* Key must read the same this many scans */
+#define KBD_REPEAT_DELAY                        250     /* Scans before a held key repeats */
+#define KBD_REPEAT_RATE                         40      /* Scans between repeats */
+#define KBD_BUF_SIZE                            16      /* Key ring size, must be a power of 2 */
 #endif /* KEYPAD_8x5_IN_USE */
 
 #ifdef SD_CARD_IN_USE
@@ -69,17 +76,30 @@
 #endif
 
 #define MAGIC_AUTORUN_NUMBER                    0xFC
-#define TIMER1_PRELOAD                          34286
 
-#ifdef KEYPAD_8x5_IN_USE
-enum E_keys_state
-{
-    E_set_row_1st = 0,
-    E_read_col_1st,
-    E_set_row_2nd,
-    E_read_col_2nd
-};
+/*
+ * Pin n is bit n % 16 of GPIO port n / 16 (A, B then C), so PA0 is pin 0,
+ * PB0 is pin 16 and PC13 is pin 45. pcbasic simulates the same pins. The
+ * analog pins are PA0-PA7 and PB0-PB1. The keypad is on PA0-PA3, PA8 and
+ * port B, and the LCD on PB6-PB7, so those are best left alone.
+ */
+#define PIN_PORTS                               3
+#define PIN_COUNT                               (PIN_PORTS * 16)
+
+/* Edges host_watch_pin() queues, RISING|FALLING = CHANGE */
+#define PIN_EVENT_OFF                           0
+#define PIN_EVENT_RISING                        1
+#define PIN_EVENT_FALLING                       2
+#define PIN_EVENT_CHANGE                        3
+#define PIN_EVENT_SLOTS                         4       /* Pins watched at once */
+#define PIN_EVENT_QUEUE                         16      /* Must be a power of 2 */
+#define SAMPLE_QUEUE                            64      /* Readings waiting for SAMPLE */
+#ifdef PCBASIC_TARGET
+#define SAMPLE_RATE_MAX                         100000
+#else
+#define SAMPLE_RATE_MAX                         20000   /* The queue lasts 3.2ms */
 #endif
+#define TIMER1_PRELOAD                          34286
 
 #ifdef PCBASIC_TARGET
 void SetCursorToPos(int x, int y);
@@ -89,10 +109,21 @@ void ShowPrompt();
 
 void host_init(int buzzerPin);
 void host_sleep(long ms);
+uint32_t host_millis(void);
 void host_digitalWrite(int pin,int state);
 int host_digitalRead(int pin);
 int host_analogRead(int pin);
 void host_pinMode(int pin, int mode);
+bool host_watch_pin(int pin, int mode);
+int host_get_pin_event(void);
+unsigned int host_pin_events_dropped(int pin);
+bool host_start_sampling(int pin, uint32_t rate);
+void host_stop_sampling(void);
+int host_get_sample(void);
+bool host_samples_lost(void);
+bool host_port_out(int port, int mask, int value);
+int host_port_in(int port);
+bool host_shift_out(int dataPin, int clockPin, int bitOrder, float *values, int count);
 void host_click(void);
 void host_startupTone(void);
 void host_cls(void);
@@ -104,6 +135,7 @@ void host_outputProgMemString(const char *str);
 void host_output_char(char c);
 void host_output_float(float f);
 char *host_float_to_str(float f, char *buf);
+float host_str_to_float(const char *str, const char **end);
 int host_output_int(long val);
 void host_new_line(void);
 char *host_readLine(void);
@@ -115,18 +147,17 @@ void host_loadProgram(void);
 
 #ifdef KEYPAD_8x5_IN_USE
 void handler_timer_int(void);
-void state_machine_init(void);
-void state_machine_set_row_1st(void);
-void state_machine_read_column_1st(void);
-void state_machine_set_row_2nd(void);
-void state_machine_read_column_2nd(void);
 char get_key(void);
 #endif /* KEYPAD_8x5_IN_USE */
 
 #ifdef PCBASIC_TARGET
 #ifndef WIN32
 char lingetch(void);
+int lingetch_nowait(void);
 #endif /* WIN32 */
+bool host_input_replay(const char *fileName);
+int host_input_key(bool wait);
+void host_input_echoed(void);
 #endif /* PCBASIC_TARGET */
 
 #ifdef SERIAL_TRACES_ON
@@ -15,10 +15,25 @@ const char welcomeStr[] = "PCBASIC v0.62 WIN";
 const char welcomeStr[] = "PCBASIC v0.62 LIN";
 #endif
 
-int main(void)
+int main(int argc, char *argv[])
 {
     uint8_t in_loop = 1;
 
+    /* pcbasic -r FILE: type the keys in FILE (- for stdin), see host.c */
+    if (argc == 3 && strcmp(argv[1], "-r") == 0)
+    {
+        if (!host_input_replay(argv[2]))
+        {
+            perror(argv[2]);
+            return 1;
+        }
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "usage: %s [-r replayfile]\n", argv[0]);
+        return 1;
+    }
+
     reset_basic();
     host_init(BUZZER_PIN);
     host_cls();
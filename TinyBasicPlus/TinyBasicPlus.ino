@@ -178,6 +178,14 @@ char eliminateCompileErrors = 1;  // fix to suppress arduino build errors
 #define ENABLE_EEPROM 1
 //#undef ENABLE_EEPROM
 
+// Variables and expressions are 16 bit (-32768..32767) by default.
+// Enabling this makes them 32 bit, for programs working with millis()
+// sized numbers or large sums.  Each variable takes 4 bytes instead of 2,
+// and arithmetic is slower on 8-bit AVRs, so only turn it on if there's
+// RAM to spare.
+//#define ENABLE_LONG_VARS 1
+#undef ENABLE_LONG_VARS
+
 // Sometimes, we connect with a slower device as the console.
 // Set your console D0/D1 baud rate here (9600 baud default)
 #define kConsoleBaud 9600
@@ -271,9 +279,8 @@ char eliminateCompileErrors = 1;  // fix to suppress arduino build errors
   // size of our program ram
   #define kRamSize   64*1024 /* arbitrary - not dependant on libraries */
 
-  #ifdef ENABLE_FILEIO
-    FILE * fp;
-  #endif
+  // LOAD, SAVE and CHAIN use files in the current directory (desktop.cpp)
+  #define ENABLE_FILEIO 1
 #endif
 
 ////////////////////
@@ -315,10 +322,16 @@ char eliminateCompileErrors = 1;  // fix to suppress arduino build errors
 
 #ifdef ENABLE_FILEIO
   // functions defined elsehwere
-  void cmd_Files( void );
   unsigned char * filenameWord(void);
+  static unsigned char isImageName( unsigned char *name );
+  static void saveImage( void );
+  static unsigned char loadImage( void );
+  static void fileClose( void );
+#ifdef ARDUINO
+  void cmd_Files( void );
   static boolean sd_is_initialized = false;
 #endif
+#endif
 
 // some settings based things
 
@@ -335,6 +348,22 @@ enum {
 static unsigned char inStream = kStreamSerial;
 static unsigned char outStream = kStreamSerial;
 
+// Console output is collected in outbuf and written in one go at the end
+// of each PRINT, before waiting for input and before DELAY, rather than
+// one Serial.write() per character.  Between statements, breakcheck()
+// sends it early if the serial port can take it without waiting.
+// breakcheck() also moves typed characters into inbuf, so that looking
+// for Ctrl-C doesn't throw away what the user typed ahead.
+#define kOutBufSize 32
+#define kInBufSize  16 /* must be a power of 2 */
+#ifdef ARDUINO
+static unsigned char outbuf[kOutBufSize];
+static unsigned char outlen = 0;
+static unsigned char inbuf[kInBufSize];
+static unsigned char inhead = 0, intail = 0;
+#endif
+unsigned long outputCount = 0; // characters sent to the console
+
 
 ////////////////////////////////////////////////////////////////////////////////
 // ASCII Characters
@@ -352,6 +381,11 @@ static unsigned char outStream = kStreamSerial;
 #define CTRLX	0x18
 
 typedef short unsigned LINENUM;
+#ifdef ENABLE_LONG_VARS
+typedef long VAR_TYPE;
+#else
+typedef short int VAR_TYPE;
+#endif
 #ifdef ARDUINO
 #define ECHO_CHARS 1
 #else
@@ -447,8 +481,8 @@ enum {
 struct stack_for_frame {
   char frame_type;
   char for_var;
-  short int terminal;
-  short int step;
+  VAR_TYPE terminal;
+  VAR_TYPE step;
   unsigned char *current_line;
   unsigned char *txtpos;
 };
@@ -514,8 +548,22 @@ const static unsigned char highlow_tab[] PROGMEM = {
 #define HIGHLOW_HIGH    1
 #define HIGHLOW_UNKNOWN 4
 
+// Program lines are "crunched" when they are entered: keywords, function
+// names, TO, STEP and relational operators are replaced by a single byte
+// token with the top bit set, so the interpreter can switch on it instead
+// of scanning the tables above on every execution.  Program text is 7-bit
+// ASCII, so the tokens can't be confused with it.  Quoted strings and the
+// rest of the line after REM, LOAD, SAVE and CHAIN are left as text.
+// LIST (and so SAVE and ESAVE) turns the tokens back into text.
+#define TOK_KEYWORD   0x80 /* + KW_xxx */
+#define TOK_FUNC      0xC0 /* + FUNC_xxx */
+#define TOK_TO        0xC8
+#define TOK_STEP      0xC9
+#define TOK_RELOP     0xD0 /* + RELOP_xxx */
+#define TOK_EQ        (TOK_RELOP + RELOP_EQ)
+
 #define STACK_SIZE (sizeof(struct stack_for_frame)*5)
-#define VAR_SIZE sizeof(short int) // Size of variables in bytes
+#define VAR_SIZE sizeof(VAR_TYPE) // Size of variables in bytes
 
 static unsigned char *stack_limit;
 static unsigned char *program_start;
@@ -529,6 +577,16 @@ static unsigned char *sp;
 static unsigned char table_index;
 static LINENUM linenum;
 
+// Direct-mapped cache of GOTO/GOSUB targets: line number -> line.
+// It is emptied whenever we get back to the prompt, since that is the
+// only place the program can be edited, so a hit is always valid.
+#define LINE_CACHE_SIZE 8 /* must be a power of 2 */
+struct line_cache_entry {
+  LINENUM linenum;
+  unsigned char *line;
+};
+static struct line_cache_entry line_cache[LINE_CACHE_SIZE];
+
 static const unsigned char okmsg[]            PROGMEM = "OK";
 static const unsigned char whatmsg[]          PROGMEM = "Syntax Error ";
 static const unsigned char howmsg[]           PROGMEM =	"\nBad Number";
@@ -547,14 +605,16 @@ static const unsigned char backspacemsg[]     PROGMEM = "\b \b";
 static const unsigned char indentmsg[]        PROGMEM = "    ";
 static const unsigned char sderrormsg[]       PROGMEM = "SD card error.";
 static const unsigned char sdfilemsg[]        PROGMEM = "SD file error.";
+static const unsigned char imagemsg[]         PROGMEM = "Bad program image.";
 static const unsigned char dirextmsg[]        PROGMEM = "(dir)";
 static const unsigned char slashmsg[]         PROGMEM = "/";
 static const unsigned char spacemsg[]         PROGMEM = " ";
 
 static int inchar(void);
 static void outchar(unsigned char c);
+static void outflush(void);
 static void line_terminator(void);
-static short int expression(void);
+static VAR_TYPE expression(void);
 static unsigned char breakcheck(void);
 /***************************************************************************/
 static void ignore_blanks(void)
@@ -564,7 +624,9 @@ static void ignore_blanks(void)
 }
 
 
+#ifdef ARDUINO
 /***************************************************************************/
+// Only the pin commands still use this, the rest go through matchtable()
 static void scantable(const unsigned char *table)
 {
   int i = 0;
@@ -603,6 +665,164 @@ static void scantable(const unsigned char *table)
     }
   }
 }
+#endif /* ARDUINO */
+
+/***************************************************************************/
+// Find the table entry matching the text at p. Returns its index and the
+// number of characters it covers, or 0xFF if there is no match.
+static unsigned char matchtable(const unsigned char *table, unsigned char *p, unsigned char *len)
+{
+  unsigned char index = 0;
+  unsigned char i;
+  unsigned char t;
+
+  while(pgm_read_byte( table ) != 0)
+  {
+    i = 0;
+    while(1)
+    {
+      t = pgm_read_byte( table+i );
+      if(t & 0x80)
+      {
+        // Last character of the entry
+        if(p[i]+0x80 == t)
+        {
+          *len = i+1;
+          return index;
+        }
+        break;
+      }
+      if(p[i] != t)
+        break;
+      i++;
+    }
+
+    // Forward to the start of the next entry
+    while((pgm_read_byte( table ) & 0x80) == 0)
+      table++;
+    table++;
+    index++;
+  }
+  return 0xFF;
+}
+
+/***************************************************************************/
+// Crunch the (uppercased) line in the input buffer in place.
+static void crunchBuffer(void)
+{
+  unsigned char *from = program_end+sizeof(LINENUM);
+  unsigned char *to = from;
+  unsigned char quote = 0;
+  unsigned char index, len, tok;
+
+  while(*from != NL)
+  {
+    // Are we in a quoted string?
+    if(quote)
+    {
+      if(*from == quote)
+        quote = 0;
+      *to++ = *from++;
+      continue;
+    }
+    if(*from == '"' || *from == '\'')
+    {
+      quote = *from;
+      *to++ = *from++;
+      continue;
+    }
+
+    tok = 0;
+    if((*from >= 'A' && *from <= 'Z') || *from == '?')
+    {
+      if((index = matchtable(keywords, from, &len)) != 0xFF)
+        tok = TOK_KEYWORD + index;
+      else if((index = matchtable(func_tab, from, &len)) != 0xFF)
+        tok = TOK_FUNC + index;
+      else if(matchtable(to_tab, from, &len) != 0xFF)
+        tok = TOK_TO;
+      else if(matchtable(step_tab, from, &len) != 0xFF)
+        tok = TOK_STEP;
+    }
+    else if(*from == '<' || *from == '>' || *from == '=' || *from == '!')
+    {
+      if((index = matchtable(relop_tab, from, &len)) != 0xFF)
+        tok = TOK_RELOP + index;
+    }
+
+    if(tok == 0)
+    {
+      *to++ = *from++;
+      continue;
+    }
+
+    *to++ = tok;
+    from += len;
+
+    // Comments and filenames stay as they were typed
+    if(tok == TOK_KEYWORD+KW_REM || tok == TOK_KEYWORD+KW_LOAD ||
+       tok == TOK_KEYWORD+KW_SAVE || tok == TOK_KEYWORD+KW_CHAIN)
+      break;
+  }
+
+  // Copy the rest of the line and its terminator
+  while(*from != NL)
+    *to++ = *from++;
+  *to = NL;
+}
+
+/***************************************************************************/
+// Print the text of a token, or return 0 if it isn't one
+static unsigned char printtoken(unsigned char tok)
+{
+  const unsigned char *table;
+  unsigned char c;
+
+  if(tok >= TOK_RELOP)
+  {
+    table = relop_tab;
+    tok -= TOK_RELOP;
+  }
+  else if(tok == TOK_STEP)
+  {
+    table = step_tab;
+    tok = 0;
+  }
+  else if(tok == TOK_TO)
+  {
+    table = to_tab;
+    tok = 0;
+  }
+  else if(tok >= TOK_FUNC)
+  {
+    table = func_tab;
+    tok -= TOK_FUNC;
+  }
+  else if(tok >= TOK_KEYWORD)
+  {
+    table = keywords;
+    tok -= TOK_KEYWORD;
+  }
+  else
+    return 0;
+
+  // Forward to the entry
+  while(tok > 0)
+  {
+    if(pgm_read_byte( table ) == 0)
+      return 0;
+    if(pgm_read_byte( table ) & 0x80)
+      tok--;
+    table++;
+  }
+
+  do {
+    c = pgm_read_byte( table++ );
+    outchar(c & 0x7F);
+  }
+  while((c & 0x80) == 0);
+  return 1;
+}
 
 /***************************************************************************/
 static void pushb(unsigned char b)
@@ -621,7 +841,7 @@ static unsigned char popb()
 }
 
 /***************************************************************************/
-void printnum(int num)
+void printnum(VAR_TYPE num)
 {
   int digits = 0;
 
@@ -745,8 +965,12 @@ static void getln(char prompt)
       // Terminate all strings with a NL
       txtpos[0] = NL;
       return;
-      case CTRLC:
-        return 0;
+    case CTRLC:
+      // Abandon the line
+      txtpos = program_end+sizeof(LINENUM);
+      txtpos[0] = NL;
+      line_terminator();
+      return;
     case CTRLH:
       if(txtpos == program_end)
         break;
@@ -769,9 +993,9 @@ static void getln(char prompt)
 }
 
 /***************************************************************************/
-static unsigned char *findline(void)
+// Find the first line numbered linenum or above, starting at the given line
+static unsigned char *findlinefrom(unsigned char *line)
 {
-  unsigned char *line = program_start;
   while(1)
   {
     if(line == program_end)
@@ -785,6 +1009,43 @@ static unsigned char *findline(void)
   }
 }
 
+/***************************************************************************/
+static unsigned char *findline(void)
+{
+  return findlinefrom(program_start);
+}
+
+/***************************************************************************/
+static void clear_line_cache(void)
+{
+  unsigned char i;
+
+  for(i = 0; i < LINE_CACHE_SIZE; i++)
+    line_cache[i].line = NULL;
+}
+
+/***************************************************************************/
+// findline() for GOTO and GOSUB: look in the cache first, and start
+// looking at the current line when jumping forwards.
+static unsigned char *findjumpline(void)
+{
+  struct line_cache_entry *e = &line_cache[linenum & (LINE_CACHE_SIZE-1)];
+  unsigned char *line;
+
+  if(e->line != NULL && e->linenum == linenum)
+    return e->line;
+
+  if(current_line != NULL && current_line != program_end &&
+     ((LINENUM *)current_line)[0] < linenum)
+    line = findlinefrom(current_line);
+  else
+    line = findline();
+
+  e->linenum = linenum;
+  e->line = line;
+  return line;
+}
+
 /***************************************************************************/
 static void toUppercaseBuffer(void)
 {
@@ -812,13 +1073,39 @@ void printline()
   line_num = *((LINENUM *)(list_line));
   list_line += sizeof(LINENUM) + sizeof(char);
 
-  // Output the line */
-  printnum(line_num);
+  // Output the line, turning tokens back into text */
+  printUnum(line_num);
   outchar(' ');
-  while(*list_line != NL)
   {
-    outchar(*list_line);
-    list_line++;
+    unsigned char quote = 0;
+    unsigned char literal = 0;
+
+    while(*list_line != NL)
+    {
+      unsigned char c = *list_line;
+      if(quote)
+      {
+        if(c == quote)
+          quote = 0;
+        outchar(c);
+      }
+      else if(literal || c < 0x80)
+      {
+        if(!literal && (c == '"' || c == '\''))
+          quote = c;
+        outchar(c);
+      }
+      else
+      {
+        if(!printtoken(c))
+          outchar(c);
+        // As in crunchBuffer(), the rest of the line is text
+        if(c == TOK_KEYWORD+KW_REM || c == TOK_KEYWORD+KW_LOAD ||
+           c == TOK_KEYWORD+KW_SAVE || c == TOK_KEYWORD+KW_CHAIN)
+          literal = 1;
+      }
+      list_line++;
+    }
   }
   list_line++;
 #ifdef ALIGN_MEMORY
@@ -830,7 +1117,7 @@ void printline()
 }
 
 /***************************************************************************/
-static short int expr4(void)
+static VAR_TYPE expr4(void)
 {
   // fix provided by Jurg Wullschleger wullschleger@gmail.com
   // fixes whitespace and unary operations
@@ -850,7 +1137,7 @@ static short int expr4(void)
 
   if(*txtpos >= '1' && *txtpos <= '9')
   {
-    short int a = 0;
+    VAR_TYPE a = 0;
     do 	{
       a = a*10 + *txtpos - '0';
       txtpos++;
@@ -859,24 +1146,24 @@ static short int expr4(void)
     return a;
   }
 
-  // Is it a function or variable reference?
+  // Is it a variable reference (single alpha)
   if(txtpos[0] >= 'A' && txtpos[0] <= 'Z')
   {
-    short int a;
-    // Is it a variable reference (single alpha)
-    if(txtpos[1] < 'A' || txtpos[1] > 'Z')
-    {
-      a = ((short int *)variables_begin)[*txtpos - 'A'];
-      txtpos++;
-      return a;
-    }
-
-    // Is it a function with a single parameter
-    scantable(func_tab);
-    if(table_index == FUNC_UNKNOWN)
-      goto expr4_error;
+    VAR_TYPE a;
+    if(txtpos[1] >= 'A' && txtpos[1] <= 'Z')
+      goto expr4_error;	// Not a function we know
+    a = ((VAR_TYPE *)variables_begin)[*txtpos - 'A'];
+    txtpos++;
+    return a;
+  }
 
-    unsigned char f = table_index;
+  // Is it a function with a single parameter
+  if(txtpos[0] >= TOK_FUNC && txtpos[0] < TOK_FUNC+FUNC_UNKNOWN)
+  {
+    VAR_TYPE a;
+    unsigned char f = txtpos[0] - TOK_FUNC;
+    txtpos++;
+    ignore_blanks();
 
     if(*txtpos != '(')
       goto expr4_error;
@@ -916,7 +1203,7 @@ static short int expr4(void)
 
   if(*txtpos == '(')
   {
-    short int a;
+    VAR_TYPE a;
     txtpos++;
     a = expression();
     if(*txtpos != ')')
@@ -933,9 +1220,9 @@ expr4_error:
 }
 
 /***************************************************************************/
-static short int expr3(void)
+static VAR_TYPE expr3(void)
 {
-  short int a,b;
+  VAR_TYPE a,b;
 
   a = expr4();
 
@@ -964,9 +1251,9 @@ static short int expr3(void)
 }
 
 /***************************************************************************/
-static short int expr2(void)
+static VAR_TYPE expr2(void)
 {
-  short int a,b;
+  VAR_TYPE a,b;
 
   if(*txtpos == '-' || *txtpos == '+')
     a = 0;
@@ -992,18 +1279,21 @@ static short int expr2(void)
   }
 }
 /***************************************************************************/
-static short int expression(void)
+static VAR_TYPE expression(void)
 {
-  short int a,b;
+  VAR_TYPE a,b;
 
   a = expr2();
 
   // Check if we have an error
   if(expression_error)	return a;
 
-  scantable(relop_tab);
-  if(table_index == RELOP_UNKNOWN)
+  ignore_blanks();
+  if(*txtpos < TOK_RELOP || *txtpos >= TOK_RELOP+RELOP_UNKNOWN)
     return a;
+  table_index = *txtpos - TOK_RELOP;
+  txtpos++;
+  ignore_blanks();
 
   switch(table_index)
   {
@@ -1044,7 +1334,11 @@ void loop()
   unsigned char linelen;
   boolean isDigital;
   boolean alsoWait = false;
+#ifdef ARDUINO
+#ifdef ENABLE_EEPROM
   int val;
+#endif /* ENABLE_EEPROM */
+#endif /* ARDUINO */
 
 #ifdef ARDUINO
 #ifdef ENABLE_TONES
@@ -1065,7 +1359,7 @@ void loop()
 #endif
 
   // memory free
-  printnum(variables_begin-program_end);
+  printUnum(variables_begin-program_end);
   printmsg(memorymsg);
 #ifdef ARDUINO
 #ifdef ENABLE_EEPROM
@@ -1075,6 +1369,12 @@ void loop()
 #endif /* ENABLE_EEPROM */
 #endif /* ARDUINO */
 
+#ifdef ENABLE_FILEIO
+  // the autorun program may be an image
+  if( inStream == kStreamFile )
+    loadImage();
+#endif
+
 warmstart:
   // this signifies that it is running in 'direct' mode.
   current_line = 0;
@@ -1082,6 +1382,9 @@ warmstart:
   printmsg(okmsg);
 
 prompt:
+  // The program may be about to change
+  clear_line_cache();
+
   if( triggerRun ){
     triggerRun = false;
     current_line = program_start;
@@ -1090,6 +1393,7 @@ prompt:
 
   getln( '>' );
   toUppercaseBuffer();
+  crunchBuffer();
 
   txtpos = program_end+sizeof(unsigned short);
 
@@ -1264,16 +1568,28 @@ interperateAtTxtpos:
     goto warmstart;
   }
 
-  scantable(keywords);
+  // Statements start with a keyword token; anything else is an assignment
+  if(*txtpos >= TOK_KEYWORD && *txtpos < TOK_KEYWORD+KW_DEFAULT)
+  {
+    table_index = *txtpos - TOK_KEYWORD;
+    txtpos++;
+    ignore_blanks();
+  }
+  else if(*txtpos == SQUOTE)
+    table_index = KW_QUOTE;
+  else
+    table_index = KW_DEFAULT;
 
   switch(table_index)
   {
   case KW_DELAY:
     {
 #ifdef ARDUINO
+      VAR_TYPE ms;
       expression_error = 0;
-      val = expression();
-      delay( val );
+      ms = expression();
+      outflush();
+      delay( ms );
       goto execnextline;
 #else
       goto unimplemented;
@@ -1305,7 +1621,7 @@ interperateAtTxtpos:
   case KW_LET:
     goto assignment;
   case KW_IF:
-    short int val;
+    VAR_TYPE val;
     expression_error = 0;
     val = expression();
     if(expression_error || *txtpos == NL)
@@ -1319,7 +1635,7 @@ interperateAtTxtpos:
     linenum = expression();
     if(expression_error || *txtpos != NL)
       goto qhow;
-    current_line = findline();
+    current_line = findjumpline();
     goto execline;
 
   case KW_GOSUB:
@@ -1347,6 +1663,7 @@ interperateAtTxtpos:
     goto execline;
   case KW_BYE:
     // Leave the basic interperater
+    outflush();
     return;
 
   case KW_AWRITE:  // AWRITE <pin>, HIGH|LOW
@@ -1397,6 +1714,9 @@ execnextline:
 execline:
   if(current_line == program_end) // Out of lines to run
     goto warmstart;
+#ifndef ARDUINO
+  desktop_lines_executed++;
+#endif
   txtpos = current_line+sizeof(LINENUM)+sizeof(char);
   goto interperateAtTxtpos;
 
@@ -1471,7 +1791,7 @@ eload:
 input:
   {
     unsigned char var;
-    int value;
+    VAR_TYPE value;
     ignore_blanks();
     if(*txtpos < 'A' || *txtpos > 'Z')
       goto qwhat;
@@ -1484,13 +1804,14 @@ inputagain:
     tmptxtpos = txtpos;
     getln( '?' );
     toUppercaseBuffer();
+    crunchBuffer();
     txtpos = program_end+sizeof(unsigned short);
     ignore_blanks();
     expression_error = 0;
     value = expression();
     if(expression_error)
       goto inputagain;
-    ((short int *)variables_begin)[var-'A'] = value;
+    ((VAR_TYPE *)variables_begin)[var-'A'] = value;
     txtpos = tmptxtpos;
 
     goto run_next_statement;
@@ -1499,14 +1820,14 @@ inputagain:
 forloop:
   {
     unsigned char var;
-    short int initial, step, terminal;
+    VAR_TYPE initial, step, terminal;
     ignore_blanks();
     if(*txtpos < 'A' || *txtpos > 'Z')
       goto qwhat;
     var = *txtpos;
     txtpos++;
     ignore_blanks();
-    if(*txtpos != '=')
+    if(*txtpos != TOK_EQ)
       goto qwhat;
     txtpos++;
     ignore_blanks();
@@ -1516,17 +1837,19 @@ forloop:
     if(expression_error)
       goto qwhat;
 
-    scantable(to_tab);
-    if(table_index != 0)
+    if(*txtpos != TOK_TO)
       goto qwhat;
+    txtpos++;
+    ignore_blanks();
 
     terminal = expression();
     if(expression_error)
       goto qwhat;
 
-    scantable(step_tab);
-    if(table_index == 0)
+    if(*txtpos == TOK_STEP)
     {
+      txtpos++;
+      ignore_blanks();
       step = expression();
       if(expression_error)
         goto qwhat;
@@ -1546,7 +1869,7 @@ forloop:
 
       sp -= sizeof(struct stack_for_frame);
       f = (struct stack_for_frame *)sp;
-      ((short int *)variables_begin)[var-'A'] = initial;
+      ((VAR_TYPE *)variables_begin)[var-'A'] = initial;
       f->frame_type = STACK_FOR_FLAG;
       f->for_var = var;
       f->terminal = terminal;
@@ -1572,7 +1895,7 @@ gosub:
     f->frame_type = STACK_GOSUB_FLAG;
     f->txtpos = txtpos;
     f->current_line = current_line;
-    current_line = findline();
+    current_line = findjumpline();
     goto execline;
   }
   goto qhow;
@@ -1614,7 +1937,7 @@ gosub_return:
         // Is the the variable we are looking for?
         if(txtpos[-1] == f->for_var)
         {
-          short int *varaddr = ((short int *)variables_begin) + txtpos[-1] - 'A'; 
+          VAR_TYPE *varaddr = ((VAR_TYPE *)variables_begin) + txtpos[-1] - 'A'; 
           *varaddr = *varaddr + f->step;
           // Use a different test depending on the sign of the step increment
           if((f->step > 0 && *varaddr <= f->terminal) || (f->step < 0 && *varaddr >= f->terminal))
@@ -1642,17 +1965,17 @@ gosub_return:
 
 assignment:
   {
-    short int value;
-    short int *var;
+    VAR_TYPE value;
+    VAR_TYPE *var;
 
     if(*txtpos < 'A' || *txtpos > 'Z')
       goto qhow;
-    var = (short int *)variables_begin + *txtpos - 'A';
+    var = (VAR_TYPE *)variables_begin + *txtpos - 'A';
     txtpos++;
 
     ignore_blanks();
 
-    if (*txtpos != '=')
+    if (*txtpos != TOK_EQ)
       goto qwhat;
     txtpos++;
     ignore_blanks();
@@ -1668,7 +1991,7 @@ assignment:
   goto run_next_statement;
 poke:
   {
-    short int value;
+    VAR_TYPE value;
     unsigned char *address;
 
     // Work out where to put it
@@ -1715,6 +2038,7 @@ print:
   if(*txtpos == ':' )
   {
     line_terminator();
+    outflush();
     txtpos++;
     goto run_next_statement;
   }
@@ -1734,7 +2058,7 @@ print:
       goto qwhat;
     else
     {
-      short int e;
+      VAR_TYPE e;
       expression_error = 0;
       e = expression();
       if(expression_error)
@@ -1758,11 +2082,12 @@ print:
     else
       goto qwhat;	
   }
+  outflush();
   goto run_next_statement;
 
 mem:
   // memory free
-  printnum(variables_begin-program_end);
+  printUnum(variables_begin-program_end);
   printmsg(memorymsg);
 #ifdef ARDUINO
 #ifdef ENABLE_EEPROM
@@ -1792,8 +2117,8 @@ mem:
 awrite: // AWRITE <pin>,val
 dwrite:
   {
-    short int pinNo;
-    short int value;
+    VAR_TYPE pinNo;
+    VAR_TYPE value;
     unsigned char *txtposBak;
 
     // Get the pin number
@@ -1850,7 +2175,7 @@ files:
   // display a listing of files on the device.
   // version 1: no support for subdirectories
 
-#ifdef ENABLE_FILEIO
+#if ARDUINO && ENABLE_FILEIO
     cmd_Files();
   goto warmstart;
 #else
@@ -1890,9 +2215,19 @@ load:
     }
 #else // ARDUINO
     // Desktop specific
+    if( !desktop_open_file( (const char *)filename, 0 ))
+    {
+      printmsg( sdfilemsg );
+    }
+    else {
+      inStream = kStreamFile;
+      inhibitOutput = true;
+    }
 #endif // ARDUINO
-    // this will kickstart a series of events to read in from the file.
-
+    // an image is read in here. otherwise this will kickstart a series
+    // of events to read in from the file.
+    if( inStream == kStreamFile )
+      loadImage();
   }
   goto warmstart;
 #else // ENABLE_FILEIO
@@ -1919,22 +2254,33 @@ save:
       SD.remove( (char *)filename );
     }
 
-    // open the file, switch over to file output
+    // open the file
     fp = SD.open( (const char *)filename, FILE_WRITE );
-    outStream = kStreamFile;
-
-    // copied from "List"
-    list_line = findline();
-    while(list_line != program_end)
-      printline();
-
-    // go back to standard output, close the file
-    outStream = kStreamSerial;
-
-    fp.close();
 #else // ARDUINO
     // desktop
+    if( !desktop_open_file( (const char *)filename, 1 )) {
+      printmsg( sdfilemsg );
+      goto warmstart;
+    }
 #endif // ARDUINO
+
+    if( isImageName( filename )) {
+      saveImage();
+    }
+    else {
+      // switch over to file output
+      outStream = kStreamFile;
+
+      // copied from "List"
+      list_line = findline();
+      while(list_line != program_end)
+        printline();
+
+      // go back to standard output
+      outStream = kStreamSerial;
+    }
+
+    fileClose();
     goto warmstart;
   }
 #else // ENABLE_FILEIO
@@ -1943,7 +2289,7 @@ save:
 
 rseed:
   {
-    short int value;
+    VAR_TYPE value;
 
     //Get the pin number
     expression_error = 0;
@@ -1968,8 +2314,8 @@ tonegen:
   {
     // TONE freq, duration
     // if either are 0, tones turned off
-    short int freq;
-    short int duration;
+    VAR_TYPE freq;
+    VAR_TYPE duration;
 
     //Get the frequency
     expression_error = 0;
@@ -1995,6 +2341,7 @@ tonegen:
 
     tone( kPiezoPin, freq, duration );
     if( alsoWait ) {
+      outflush();
       delay( duration );
       alsoWait = false;
     }
@@ -2046,6 +2393,156 @@ unsigned char * filenameWord(void)
   return ret;
 }
 
+/***********************************************************/
+/* Program images */
+
+#ifdef ENABLE_FILEIO
+// SAVE writes a program image instead of text when the file name ends in
+// ".TBI": a header, then the program area exactly as it is in memory.
+// LOAD and CHAIN spot the header and read the image straight into the
+// program area, rather than passing every line through the line editor,
+// so it's much faster than loading text.  Images hold crunched lines, so
+// the header records the keyword count and memory alignment, and an image
+// from a differently configured build is refused.  Use text files to move
+// programs between builds.
+//
+//   0  kImageMagic0 'T' 'B'
+//   3  kImageVersion
+//   4  number of keywords (KW_DEFAULT)
+//   5  kImageFlags
+//   6  length of the program area, low byte first
+//   8  checksum of the program area, low byte first
+//  10  the program area
+#define kImageMagic0      0x1A /* ^Z, so TYPE stops at the header */
+#define kImageVersion     1
+#define kImageHeaderSize  10
+#ifdef ALIGN_MEMORY
+  #define kImageFlags     1
+#else
+  #define kImageFlags     0
+#endif
+
+// Fletcher's checksum, with sums modulo 256 so it's cheap on AVR
+static unsigned short imageChecksum( unsigned char *p, unsigned short len )
+{
+  unsigned char a = 0, b = 0;
+
+  while( len-- ) {
+    a += *p++;
+    b += a;
+  }
+  return ((unsigned short)b << 8) | a;
+}
+
+// returns 1 if the file name ends in ".TBI"
+static unsigned char isImageName( unsigned char *name )
+{
+  unsigned char *e = name;
+
+  while( *e ) e++;
+  if( e - name < 4 ) return 0;
+  e -= 4;
+  return e[0] == '.' && (e[1] & ~0x20) == 'T' && (e[2] & ~0x20) == 'B'
+         && (e[3] & ~0x20) == 'I';
+}
+
+static int filePeek( void )
+{
+#ifdef ARDUINO
+  return fp.peek();
+#else
+  return desktop_peek_file();
+#endif
+}
+
+static unsigned short fileRead( unsigned char *buf, unsigned short len )
+{
+#ifdef ARDUINO
+  int n = fp.read( buf, len );
+  return n < 0 ? 0 : n;
+#else
+  return desktop_read_file( buf, len );
+#endif
+}
+
+static void fileWrite( unsigned char *buf, unsigned short len )
+{
+#ifdef ARDUINO
+  fp.write( buf, len );
+#else
+  desktop_write_file( buf, len );
+#endif
+}
+
+static void fileClose( void )
+{
+#ifdef ARDUINO
+  fp.close();
+#else
+  desktop_close_file();
+#endif
+}
+
+// writes the program to the open file as an image
+static void saveImage( void )
+{
+  unsigned char header[kImageHeaderSize];
+  unsigned short len = program_end - program_start;
+  unsigned short sum = imageChecksum( program_start, len );
+
+  header[0] = kImageMagic0;
+  header[1] = 'T';
+  header[2] = 'B';
+  header[3] = kImageVersion;
+  header[4] = KW_DEFAULT;
+  header[5] = kImageFlags;
+  header[6] = len & 0xff;
+  header[7] = len >> 8;
+  header[8] = sum & 0xff;
+  header[9] = sum >> 8;
+
+  fileWrite( header, kImageHeaderSize );
+  fileWrite( program_start, len );
+}
+
+// if the file being loaded is an image, reads it into the program area,
+// closes it and finishes the load.  returns 0 if it is text, for inchar()
+static unsigned char loadImage( void )
+{
+  unsigned char header[kImageHeaderSize];
+  unsigned short len;
+  boolean ok = false;
+
+  if( filePeek() != kImageMagic0 )
+    return 0;
+
+  program_end = program_start;
+  if( fileRead( header, kImageHeaderSize ) == kImageHeaderSize
+      && header[1] == 'T' && header[2] == 'B'
+      && header[3] == kImageVersion && header[4] == KW_DEFAULT
+      && header[5] == kImageFlags ) {
+    len = header[6] | ((unsigned short)header[7] << 8);
+    if( len < (unsigned short)(variables_begin - program_start)
+        && fileRead( program_start, len ) == len
+        && imageChecksum( program_start, len ) == (header[8] | ((unsigned short)header[9] << 8))) {
+      program_end = program_start + len;
+      ok = true;
+    }
+  }
+  fileClose();
+
+  inStream = kStreamSerial;
+  inhibitOutput = false;
+  if( !ok )
+    printmsg( imagemsg );
+  if( runAfterLoad ) {
+    runAfterLoad = false;
+    triggerRun = ok;
+  }
+  return 1;
+}
+#endif /* ENABLE_FILEIO */
+
 /***************************************************************************/
 static void line_terminator(void)
 {
@@ -2092,6 +2589,13 @@ void setup()
 #endif /* ENABLE_EAUTORUN */
 #endif /* ENABLE_EEPROM */
 
+#else /* ARDUINO */
+  // load and run the program named on the command line, if any
+  if( desktop_open_program() ) {
+    inStream = kStreamFile;
+    inhibitOutput = true;
+    runAfterLoad = true;
+  }
 #endif /* ARDUINO */
 }
 
@@ -2100,8 +2604,22 @@ void setup()
 static unsigned char breakcheck(void)
 {
 #ifdef ARDUINO
-  if(Serial.available())
-    return Serial.read() == CTRLC;
+  // Send pending output if it fits in the serial transmit buffer
+  if(outlen > 0 && Serial.availableForWrite() >= outlen)
+    outflush();
+
+  // Keep what's been typed, unless it's a break
+  while(Serial.available())
+  {
+    unsigned char c = Serial.read();
+    if(c == CTRLC)
+    {
+      inhead = intail = 0;
+      return 1;
+    }
+    if((unsigned char)(inhead - intail) < kInBufSize)
+      inbuf[inhead++ & (kInBufSize-1)] = c;
+  }
   return 0;
 #else
 #ifdef __CONIO__
@@ -2109,7 +2627,7 @@ static unsigned char breakcheck(void)
     return getch() == CTRLC;
   else
 #endif
-    return 0;
+    return desktop_breakcheck();
 #endif
 }
 /***********************************************************/
@@ -2147,6 +2665,9 @@ static int inchar()
      break;
   case( kStreamSerial ):
   default:
+    outflush();
+    if(inhead != intail)
+      return inbuf[intail++ & (kInBufSize-1)];
     while(1)
     {
       if(Serial.available())
@@ -2166,12 +2687,29 @@ inchar_loadfinish:
   
 #else
   // otherwise. desktop!
-  int got = getchar();
+  if( inStream == kStreamFile ) {
+    v = desktop_read_program();
+    if( v >= 0 ) {
+      if( v == NL ) v=CR; // file translate
+      return v;
+    }
+
+    // end of the file
+    inStream = kStreamSerial;
+    inhibitOutput = false;
+    if( runAfterLoad ) {
+      runAfterLoad = false;
+      triggerRun = true;
+    }
+    return NL; // trigger a prompt.
+  }
+
+  v = desktop_getch();
 
   // translation for desktop systems
-  if( got == LF ) got = CR;
+  if( v == LF ) v = CR;
 
-  return got;
+  return v;
 #endif
 }
 
@@ -2196,10 +2734,34 @@ static void outchar(unsigned char c)
     else 
   #endif /* ENABLE_EEPROM */
   #endif /* ARDUINO */
-    Serial.write(c);
+    {
+      outbuf[outlen++] = c;
+      outputCount++;
+      if(outlen == kOutBufSize)
+        outflush();
+    }
 
 #else
+  if( outStream == kStreamFile ) {
+    desktop_write_file( &c, 1 );
+    return;
+  }
   putchar(c);
+  outputCount++;
+#endif
+}
+
+/***********************************************************/
+static void outflush(void)
+{
+#ifdef ARDUINO
+  if(outlen > 0)
+  {
+    Serial.write(outbuf, outlen);
+    outlen = 0;
+  }
+#else
+  // desktop.cpp buffers stdout and flushes it before reading input
 #endif
 }
 
@@ -2237,7 +2799,7 @@ static int initSD( void )
 }
 #endif
 
-#if ENABLE_FILEIO
+#if ARDUINO && ENABLE_FILEIO
 void cmd_Files( void )
 {
   File dir = SD.open( "/" );
@@ -0,0 +1,12 @@
+10 REM TinyBasic Plus benchmark: nested loops, IF, GOSUB, arithmetic
+20 S=0
+30 FOR I=1 TO 30000
+40 FOR J=1 TO 10
+50 IF J>5 S=J-S
+60 GOSUB 200
+70 NEXT J
+80 NEXT I
+90 PRINT S
+100 END
+200 T=I*J/3+ABS(J-5)
+210 RETURN
@@ -0,0 +1,237 @@
+////////////////////////////////////////////////////////////////////////////////
+// TinyBasic Plus - desktop build
+////////////////////////////////////////////////////////////////////////////////
+//
+// Runs TinyBasic Plus in a terminal on Linux (or anything POSIX).
+//
+//    tinybasic [--bench] [program.bas]
+//
+// The program file, if given, is loaded as though it had been typed (or
+// in one go, if it was written by SAVE as a program image) and then run.
+// LOAD, SAVE and CHAIN work on files in the current directory.  When stdin
+// is a terminal it is put in raw mode so that Ctrl-C reaches the
+// interpreter and breaks a running program, instead of killing the
+// process.  Output is buffered and flushed whenever input is needed, and
+// every so often while a program runs.
+//
+// --bench reports program lines executed per second when the interpreter
+// exits, and ignores stdin so that it exits as soon as the program ends.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include "desktop.h"
+
+void setup( void );
+void loop( void );
+
+unsigned long desktop_lines_executed = 0;
+
+static FILE * progfp = NULL; // file being loaded or saved
+static const char * progname = NULL;
+static int benchmark = 0;
+static int rawmode = 0;
+static struct termios savedtio;
+static struct timespec starttime, lastflush;
+static char outbuf[ 16 * 1024 ];
+static unsigned char typeahead[ 64 ];
+static unsigned int typeaheadHead = 0, typeaheadTail = 0;
+
+/***********************************************************/
+static double elapsed( struct timespec *since )
+{
+  struct timespec now;
+  clock_gettime( CLOCK_MONOTONIC, &now );
+  return ( now.tv_sec - since->tv_sec ) + ( now.tv_nsec - since->tv_nsec ) / 1e9;
+}
+
+/***********************************************************/
+static void leave( void )
+{
+  fflush( stdout );
+
+  if( rawmode ) {
+    tcsetattr( 0, TCSAFLUSH, &savedtio );
+    rawmode = 0;
+  }
+
+  if( benchmark ) {
+    double secs = elapsed( &starttime );
+    fprintf( stderr, "\n%lu lines in %.3f s: %.0f lines/s, %lu characters output\n",
+             desktop_lines_executed, secs,
+             secs > 0 ? desktop_lines_executed / secs : 0.0,
+             outputCount );
+  }
+}
+
+/***********************************************************/
+static void enterRawMode( void )
+{
+  struct termios tio;
+
+  if( !isatty( 0 ) || tcgetattr( 0, &savedtio ) != 0 ) return;
+
+  // No line editing, echo or signals; Enter arrives as CR.
+  // Output processing stays on, so NL still starts a new line.
+  tio = savedtio;
+  tio.c_lflag &= ~( ICANON | ECHO | ISIG | IEXTEN );
+  tio.c_iflag &= ~( ICRNL | INLCR | IXON );
+  tio.c_cc[ VMIN ] = 1;
+  tio.c_cc[ VTIME ] = 0;
+  if( tcsetattr( 0, TCSAFLUSH, &tio ) == 0 ) rawmode = 1;
+}
+
+/***********************************************************/
+int desktop_open_program( void )
+{
+  if( progname == NULL ) return 0;
+
+  progfp = fopen( progname, "r" );
+  if( progfp == NULL ) {
+    perror( progname );
+    exit( 1 );
+  }
+  return 1;
+}
+
+/***********************************************************/
+int desktop_open_file( const char * name, int forWriting )
+{
+  desktop_close_file();
+  progfp = fopen( name, forWriting ? "wb" : "rb" );
+  return progfp != NULL;
+}
+
+/***********************************************************/
+void desktop_close_file( void )
+{
+  if( progfp != NULL ) {
+    fclose( progfp );
+    progfp = NULL;
+  }
+}
+
+/***********************************************************/
+int desktop_peek_file( void )
+{
+  int c;
+
+  if( progfp == NULL ) return -1;
+
+  c = fgetc( progfp );
+  if( c != EOF ) ungetc( c, progfp );
+  return c == EOF ? -1 : c;
+}
+
+/***********************************************************/
+int desktop_read_file( unsigned char * buf, int len )
+{
+  if( progfp == NULL ) return 0;
+  return (int) fread( buf, 1, len, progfp );
+}
+
+/***********************************************************/
+int desktop_write_file( const unsigned char * buf, int len )
+{
+  if( progfp == NULL ) return 0;
+  return (int) fwrite( buf, 1, len, progfp );
+}
+
+/***********************************************************/
+int desktop_read_program( void )
+{
+  int c;
+
+  if( progfp == NULL ) return -1;
+
+  c = fgetc( progfp );
+  if( c == EOF ) {
+    fclose( progfp );
+    progfp = NULL;
+    return -1;
+  }
+  return c;
+}
+
+/***********************************************************/
+int desktop_getch( void )
+{
+  unsigned char c;
+
+  fflush( stdout );
+
+  if( typeaheadHead != typeaheadTail ) {
+    return typeahead[ typeaheadTail++ % sizeof( typeahead ) ];
+  }
+
+  if( benchmark || read( 0, &c, 1 ) != 1 ) {
+    exit( 0 );
+  }
+  return c;
+}
+
+/***********************************************************/
+unsigned char desktop_breakcheck( void )
+{
+  static unsigned int calls = 0;
+  struct pollfd pfd;
+  unsigned char c;
+
+  // Only look every so often; this is called before every statement.
+  if( ++calls & 0xff ) return 0;
+
+  if( elapsed( &lastflush ) > 0.05 ) {
+    fflush( stdout );
+    clock_gettime( CLOCK_MONOTONIC, &lastflush );
+  }
+
+  // Piped input is the rest of the session, not keystrokes.
+  if( !rawmode ) return 0;
+
+  // Keep what's been typed, unless it's a break
+  pfd.fd = 0;
+  pfd.events = POLLIN;
+  while( poll( &pfd, 1, 0 ) == 1 && read( 0, &c, 1 ) == 1 ) {
+    if( c == 0x03 ) {
+      typeaheadHead = typeaheadTail = 0;
+      return 1;
+    }
+    if( typeaheadHead - typeaheadTail < sizeof( typeahead )) {
+      typeahead[ typeaheadHead++ % sizeof( typeahead ) ] = c;
+    }
+  }
+  return 0;
+}
+
+/***********************************************************/
+int main( int argc, char ** argv )
+{
+  int i;
+
+  for( i = 1 ; i < argc ; i++ ) {
+    if( !strcmp( argv[i], "--bench" )) {
+      benchmark = 1;
+    }
+    else if( argv[i][0] == '-' || progname != NULL ) {
+      fprintf( stderr, "usage: %s [--bench] [program.bas]\n", argv[0] );
+      return 2;
+    }
+    else {
+      progname = argv[i];
+    }
+  }
+
+  setvbuf( stdout, outbuf, _IOFBF, sizeof( outbuf ));
+  enterRawMode();
+  atexit( leave );
+  clock_gettime( CLOCK_MONOTONIC, &starttime );
+  lastflush = starttime;
+
+  setup();
+  loop();
+  return 0;
+}
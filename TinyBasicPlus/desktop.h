@@ -0,0 +1,42 @@
+////////////////////////////////////////////////////////////////////////////////
+// TinyBasic Plus - desktop build
+////////////////////////////////////////////////////////////////////////////////
+//
+// Included by TinyBasicPlus.ino when FORCE_DESKTOP is defined (see the
+// Makefile).  The terminal and the command line are handled in desktop.cpp.
+
+#ifndef __DESKTOP_H__
+#define __DESKTOP_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// open the program file named on the command line. returns 0 if there isn't one
+int desktop_open_program( void );
+
+// next character of the program file, or -1 at the end of it
+int desktop_read_program( void );
+
+// LOAD and SAVE. only one file is open at a time, and desktop_read_program()
+// reads from it too. desktop_open_file() returns 0 if it can't be opened
+int desktop_open_file( const char * name, int forWriting );
+void desktop_close_file( void );
+int desktop_peek_file( void );
+int desktop_read_file( unsigned char * buf, int len );
+int desktop_write_file( const unsigned char * buf, int len );
+
+// next character typed. flushes output first, exits at the end of input
+int desktop_getch( void );
+
+// returns 1 if Ctrl-C has been typed (never blocks). other characters
+// typed are kept for desktop_getch()
+unsigned char desktop_breakcheck( void );
+
+// program lines executed, for --bench
+extern unsigned long desktop_lines_executed;
+
+// characters sent to the console (TinyBasicPlus.ino)
+extern unsigned long outputCount;
+
+#endif /* __DESKTOP_H__ */
@@ -36,13 +36,27 @@
  *  - PINMODE <pin>, <mode> - sets the pin mode (0=input, 1=output, 2=pullup)
  *  - PIN <pin>, <state> - sets the pin high (non zero) or low (zero)
  *  - PINREAD(pin) returns pin value, ANALOGRD(pin) for analog pins
+ *  - DATA items are numbers or quoted strings. READ takes them in program
+ *     order, RESTORE starts again from the beginning and RESTORE n from the
+ *     first DATA statement at or after line n.
+ *  - ABS, SQR, SIN, COS, ATN, EXP and LOG work in radians. MATH_PRECISION in
+ *     config.h trades their accuracy for speed on AVR (see fastmath.h).
+ *  - ON PIN n RISING|FALLING|CHANGE GOSUB line runs line as a subroutine
+ *     when that edge arrives on pin n, in between the program's own
+ *     statements. ON PIN n OFF stops it. PINLOST(n) counts the edges lost
+ *     because too many were waiting.
+ *  - ON TIMER ms GOSUB line runs line every ms milliseconds, the same way.
+ *     Each handler line has its own timer; ON TIMER 0 GOSUB line stops one
+ *     and ON TIMER OFF stops them all.
+ *  - SAMPLE pin, array, count, rate reads an analog pin rate times a second
+ *     into the first count elements of a numeric array, in the background.
+ *     SAMPLED is how many have arrived so far, or -1 if some were lost.
+ *  - PORTOUT port, mask, value sets the pins of a whole port at once, and
+ *     PORTIN(port) reads them. SHIFTOUT dataPin, clockPin, bitOrder, array,
+ *     count clocks out the first count elements of an array as bytes.
  * ---------------------------------------------------------------------------
  */
 
-// TODO
-// ABS, SIN, COS, EXP etc
-// DATA, READ, RESTORE
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -53,6 +67,7 @@
 
 #include "basic.h"
 #include "host.h"
+#include "fastmath.h"
 
 #include <avr/pgmspace.h>
 
@@ -86,6 +101,7 @@ const char string_21[] PROGMEM = "Bad array index";
 const char string_22[] PROGMEM = "Bad string index";
 const char string_23[] PROGMEM = "Error in VAL input";
 const char string_24[] PROGMEM = "Bad parameter";
+const char string_25[] PROGMEM = "Out of DATA";
 
 //PROGMEM const char *errorTable[] = {
 const char* const errorTable[] PROGMEM = {
@@ -95,7 +111,7 @@ const char* const errorTable[] PROGMEM = {
     string_12, string_13, string_14, string_15,
     string_16, string_17, string_18, string_19,
     string_20, string_21, string_22, string_23,
-    string_24
+    string_24, string_25
 };
 
 // Token flags
@@ -128,11 +144,17 @@ PROGMEM const TokenTableEntry tokenTable[] = {
     {"THEN",TKN_FMT_PRE|TKN_FMT_POST}, {"LEN",1|TKN_ARG1_TYPE_STR}, {"VAL",1|TKN_ARG1_TYPE_STR}, {"RND",0},
     {"INT",1}, {"STR$", 1|TKN_RET_TYPE_STR}, {"FOR",TKN_FMT_POST}, {"TO",TKN_FMT_PRE|TKN_FMT_POST},
     {"STEP",TKN_FMT_PRE|TKN_FMT_POST}, {"NEXT", TKN_FMT_POST}, {"MOD",TKN_FMT_PRE|TKN_FMT_POST}, {"NEW",TKN_FMT_POST},
-    {"GOSUB",TKN_FMT_POST}, {"RETURN",TKN_FMT_POST}, {"DIM", TKN_FMT_POST}, {"LEFT$",2|TKN_ARG1_TYPE_STR|TKN_RET_TYPE_STR},
+    {"GOSUB",TKN_FMT_PRE|TKN_FMT_POST}, {"RETURN",TKN_FMT_POST}, {"DIM", TKN_FMT_POST}, {"LEFT$",2|TKN_ARG1_TYPE_STR|TKN_RET_TYPE_STR},
     {"RIGHT$",2|TKN_ARG1_TYPE_STR|TKN_RET_TYPE_STR}, {"MID$",3|TKN_ARG1_TYPE_STR|TKN_RET_TYPE_STR}, {"CLS",TKN_FMT_POST}, {"PAUSE",TKN_FMT_POST},
     {"POSITION", TKN_FMT_POST},  {"PIN",TKN_FMT_POST}, {"PINMODE", TKN_FMT_POST}, {"INKEY$", 0},
     {"SAVE", TKN_FMT_POST}, {"LOAD", TKN_FMT_POST}, {"PINREAD",1}, {"ANALOGRD",1},
-    {"DIR", TKN_FMT_POST}, {"DELETE", TKN_FMT_POST}
+    {"DIR", TKN_FMT_POST}, {"DELETE", TKN_FMT_POST}, {"DATA", TKN_FMT_POST}, {"READ", TKN_FMT_POST},
+    {"RESTORE", TKN_FMT_POST}, {"ABS",1}, {"SQR",1}, {"SIN",1},
+    {"COS",1}, {"ATN",1}, {"EXP",1}, {"LOG",1},
+    {"ON",TKN_FMT_POST}, {"RISING",TKN_FMT_PRE|TKN_FMT_POST}, {"FALLING",TKN_FMT_PRE|TKN_FMT_POST}, {"CHANGE",TKN_FMT_PRE|TKN_FMT_POST},
+    {"OFF",TKN_FMT_PRE}, {"PINLOST",1}, {"TIMER",TKN_FMT_POST},
+    {"SAMPLE",TKN_FMT_POST}, {"SAMPLED",0}, {"PORTOUT",TKN_FMT_POST}, {"PORTIN",1},
+    {"SHIFTOUT",TKN_FMT_POST}
 };
 
 
@@ -141,7 +163,10 @@ PROGMEM const TokenTableEntry tokenTable[] = {
  * **************************************************************************/
 void printTokens(unsigned char *p) {
     int modeREM = 0;
+    int spaced = 1;	// the last thing printed was a space, so a TKN_FMT_PRE one isn't needed
     while (*p != TOKEN_EOL) {
+        int wasSpaced = spaced;
+        spaced = 0;
         if (*p == TOKEN_IDENT) {
             p++;
             while (*p < 0x80)
@@ -176,11 +201,13 @@ void printTokens(unsigned char *p) {
         }
         else {
             uint8_t fmt = pgm_read_byte_near(&tokenTable[*p].format);
-            if (fmt & TKN_FMT_PRE)
+            if ((fmt & TKN_FMT_PRE) && !wasSpaced)
                 host_outputChar(' ');
             host_outputString((char *)pgm_read_word(&tokenTable[*p].token));
-            if (fmt & TKN_FMT_POST)
+            if (fmt & TKN_FMT_POST) {
                 host_outputChar(' ');
+                spaced = 1;
+            }
             if (*p==TOKEN_REM)
                 modeREM = 1;
             p++;
@@ -219,6 +246,9 @@ void deleteProgLine(unsigned char *p) {
     memmove(p, p+lineLen, &mem[sysPROGEND] - p);
 }
 
+void restoreData(unsigned char *line);
+void clearEventHandlers();
+
 int doProgLine(uint16_t lineNumber, unsigned char* tokenPtr, int tokensLength)
 {
     // find line of the at or immediately after the number
@@ -230,8 +260,10 @@ int doProgLine(uint16_t lineNumber, unsigned char* tokenPtr, int tokensLength)
     if (foundLine == lineNumber)
         deleteProgLine(p);
     // now check to see if this is an empty line, if so don't insert it
-    if (*tokenPtr == TOKEN_EOL)
+    if (*tokenPtr == TOKEN_EOL) {
+        restoreData(&mem[0]);
         return 1;
+    }
     // we now need to insert the new line at p
     int bytesNeeded = 4 + tokensLength;	// length, linenum + tokens
     if (sysPROGEND + bytesNeeded > sysVARSTART)
@@ -245,6 +277,7 @@ int doProgLine(uint16_t lineNumber, unsigned char* tokenPtr, int tokensLength)
     p += 2;
     memcpy(p, tokenPtr, tokensLength);
     sysPROGEND += bytesNeeded;
+    restoreData(&mem[0]);
     return 1;
 }
 
@@ -373,6 +406,11 @@ void stackMidStr(int start, int len) {
 // | len    | type  | name            | num dims | dim1  |      | dimN  | elem(1,..1) |
 // | 2bytes | 1byte | null terminated | 2bytes   | 2bytes|      | 2bytes| float       |
 // +--------+-------+-----------------+----------+-------+ . . .+-------+-------------+. . 
+//
+// String arrays have a table of numElements+1 offsets (2 bytes each, counted from
+// the start of the table) after the dims, followed by the strings. Element n
+// lives between table[n] and table[n+1], so it can be found without scanning
+// and rewritten in place if the new value fits.
 
 // variable type byte
 #define VAR_TYPE_NUM		0x1
@@ -395,8 +433,38 @@ unsigned char *findVariable(char *searchName, int searchMask) {
     return NULL;
 }
 
+// Array elements are the hot path in most programs, so the last few arrays
+// used are remembered rather than searched for in the variable table each
+// time. Anything that moves existing variables must invalidate the cache.
+#define ARRAY_CACHE_SIZE	2
+static struct {
+    char name[MAX_IDENT_LEN+1];
+    unsigned char *var;
+} arrayCache[ARRAY_CACHE_SIZE];
+static unsigned char arrayCacheNext;
+
+void invalidateArrayCache() {
+    for (int i=0; i<ARRAY_CACHE_SIZE; i++)
+        arrayCache[i].name[0] = 0;
+}
+
+unsigned char *findArray(char *name, int type) {
+    for (int i=0; i<ARRAY_CACHE_SIZE; i++) {
+        if (strcasecmp(arrayCache[i].name, name) == 0)
+            return arrayCache[i].var;
+    }
+    unsigned char *p = findVariable(name, type);
+    if (p != NULL) {
+        strcpy(arrayCache[arrayCacheNext].name, name);
+        arrayCache[arrayCacheNext].var = p;
+        arrayCacheNext = (arrayCacheNext + 1) % ARRAY_CACHE_SIZE;
+    }
+    return p;
+}
+
 void deleteVariableAt(unsigned char *pos) {
     int len = *(uint16_t *)pos;
+    invalidateArrayCache();
     if (pos == &mem[sysVARSTART]) {
         sysVARSTART += len;
         return;
@@ -525,7 +593,11 @@ int createArray(char *name, int isString) {
         int dim = (int)stackPopNum();
         numElements *= dim;
     }
-    bytesNeeded += 2 * numDims + (isString ? 1 : sizeof(float)) * numElements;
+    bytesNeeded += 2 * numDims;
+    if (isString)
+        bytesNeeded += 2 * (numElements + 1) + numElements;	// offset table + empty strings
+    else
+        bytesNeeded += sizeof(float) * numElements;
     // strings and arrays are re-allocated if they already exist
     unsigned char *p = findVariable(name, (isString ? VAR_TYPE_STR_ARRAY : VAR_TYPE_NUM_ARRAY));
     if (p != NULL) {
@@ -554,131 +626,66 @@ int createArray(char *name, int isString) {
         *(uint16_t *)p = dim; 
         p += 2;
     }
+    if (isString) {
+        uint16_t *table = (uint16_t *)p;
+        int strStart = 2 * (numElements + 1);
+        for (int i=0; i<=numElements; i++)
+            table[i] = strStart + i;
+        p += strStart;
+    }
     memset(p, 0, numElements * (isString ? 1 : sizeof(float)));
     return 1;
 }
 
-int _getArrayElemOffset(unsigned char **p, int *pOffset) {
-    // check for correct dimensionality
-    int numArrayDims = *(uint16_t*)*p; 
-    *p+=2;
-    int numDimsGiven = (int)stackPopNum();
-    if (numArrayDims != numDimsGiven)
-        return ERROR_WRONG_ARRAY_DIMENSIONS;
-    // now lookup the element
-    int offset = 0;
-    int base = 1;
-    for (int i=0; i<numArrayDims; i++) {
-        int index = (int)stackPopNum();
-        int arrayDim = *(uint16_t*)*p; 
-        *p+=2;
-        if (index < 1 || index > arrayDim)
-            return ERROR_ARRAY_SUBSCRIPT_OUT_RANGE;
-        offset += base * (index-1);
-        base *= arrayDim;
-    }
-    *pOffset = offset;
-    return 0;
-}
+// the element functions take the array's elements (or offset table, for
+// string arrays) and the element offset, as found by parseArrayElement()
 
-int setNumArrayElem(char *name, float val) {
-    // each index and number of dimensions on the calculator stack
-    unsigned char *p = findVariable(name, VAR_TYPE_NUM_ARRAY);
-    if (p == NULL)
-        return ERROR_VARIABLE_NOT_FOUND;
-    p += 3 + strlen(name) + 1;
-    
-    int offset;
-    int ret = _getArrayElemOffset(&p, &offset);
-    if (ret) return ret;
-    
-    p += sizeof(float)*offset;
-    *(float *)p = val;
-    return ERROR_NONE;
+void setNumArrayElem(unsigned char *elems, int offset, float val) {
+    *(float *)(elems + sizeof(float)*offset) = val;
 }
 
-int setStrArrayElem(char *name) {
-    // string is top of the stack
-    // each index and number of dimensions on the calculator stack
-
-    // keep the current stack position, since we can't overwrite the value string
-    int oldSTACKEND = sysSTACKEND;
-    // how long is the new value?
-    char *newValPtr = stackPopStr();
-    int newValLen = strlen(newValPtr);
-
-    unsigned char *p = findVariable(name, VAR_TYPE_STR_ARRAY);
-    unsigned char *p1 = p;	// so we can correct the length when done
-    if (p == NULL)
-        return ERROR_VARIABLE_NOT_FOUND;
-
-    p += 3 + strlen(name) + 1;
-    
-    int offset;
-    int ret = _getArrayElemOffset(&p, &offset);
-    if (ret) return ret;
-    
-    // find the correct element by skipping over null terminators
-    int i = 0;
-    while (i < offset) {
-        if (*p == 0) i++;
-        p++;
-    }
-    int oldValLen = strlen((char*)p);
-    int bytesNeeded = newValLen - oldValLen;
-    // check if we've got enough room for the new value
-    if (sysVARSTART - bytesNeeded < oldSTACKEND)
-        return 0;	// out of memory
-    // correct the length of the variable
-    *(uint16_t*)p1 += bytesNeeded;
-    memmove(&mem[sysVARSTART - bytesNeeded], &mem[sysVARSTART], p - &mem[sysVARSTART]);
+int setStrArrayElem(unsigned char *var, unsigned char *elems, int offset, char *val) {
+    uint16_t *table = (uint16_t *)elems;
+    unsigned char *elem = elems + table[offset];
+    int bytesNeeded = (int)strlen(val) + 1 - (table[offset+1] - table[offset]);
+    if (bytesNeeded > 0) {
+        // check if we've got enough room for the new value
+        if (sysVARSTART - bytesNeeded < sysSTACKEND)
+            return ERROR_OUT_OF_MEMORY;
+        // correct the length of the variable
+        *(uint16_t*)var += bytesNeeded;
+        // grow the slot downwards - everything before it moves, so the offsets
+        // of the elements after it increase
+        memmove(&mem[sysVARSTART - bytesNeeded], &mem[sysVARSTART], elem - &mem[sysVARSTART]);
+        sysVARSTART -= bytesNeeded;
+        invalidateArrayCache();
+        elem -= bytesNeeded;
+        table = (uint16_t *)((unsigned char *)table - bytesNeeded);
+        int numElements = (table[0] >> 1) - 1;
+        for (int i=offset+1; i<=numElements; i++)
+            table[i] += bytesNeeded;
+    }
     // copy in the new value
-    strcpy((char*)(p - bytesNeeded), newValPtr);
-    sysVARSTART -= bytesNeeded;
+    strcpy((char*)elem, val);
     return ERROR_NONE;
 }
 
-float lookupNumArrayElem(char *name, int *error) {
-    // each index and number of dimensions on the calculator stack
-    unsigned char *p = findVariable(name, VAR_TYPE_NUM_ARRAY);
-    if (p == NULL) {
-        *error = ERROR_VARIABLE_NOT_FOUND;
-        return 0.0f;
-    }
-    p += 3 + strlen(name) + 1;
-    
-    int offset;
-    int ret = _getArrayElemOffset(&p, &offset);
-    if (ret) {
-        *error = ret;
-        return 0.0f;
-    }
-    p += sizeof(float)*offset;
-    return *(float *)p;
+float lookupNumArrayElem(unsigned char *elems, int offset) {
+    return *(float *)(elems + sizeof(float)*offset);
 }
 
-char *lookupStrArrayElem(char *name, int *error) {
-    // each index and number of dimensions on the calculator stack
-    unsigned char *p = findVariable(name, VAR_TYPE_STR_ARRAY);
-    if (p == NULL) {
-        *error = ERROR_VARIABLE_NOT_FOUND;
-        return NULL;
-    }
-    p += 3 + strlen(name) + 1;
+char *lookupStrArrayElem(unsigned char *elems, int offset) {
+    return (char *)elems + ((uint16_t *)elems)[offset];
+}
 
-    int offset;
-    int ret = _getArrayElemOffset(&p, &offset);
-    if (ret) {
-        *error = ret;
-        return NULL;
-    }
-    // find the correct element by skipping over null terminators
-    int i = 0;
-    while (i < offset) {
-        if (*p == 0) i++;
-        p++;
-    }
-    return (char *)p;
+// the elements of the numeric array var, and how many there are
+float *numArrayElems(unsigned char *var, char *name, int *numElements) {
+    uint16_t *dims = (uint16_t *)(var + 3 + strlen(name) + 1);
+    int numDims = *dims++;
+    *numElements = 1;
+    for (int i = 0; i < numDims; i++)
+        *numElements *= dims[i];
+    return (float *)(dims + numDims);
 }
 
 float lookupNumVariable(char *name) {
@@ -731,6 +738,7 @@ int gosubStackPush(int lineNumber,int stmtNumber) {
         return 0;	// out of memory
     // shift the variable table
     memmove(&mem[sysVARSTART]-bytesNeeded, &mem[sysVARSTART], sysVAREND-sysVARSTART);
+    invalidateArrayCache();
     sysVARSTART -= bytesNeeded;
     sysVAREND -= bytesNeeded;
     // push the return address
@@ -750,12 +758,276 @@ int gosubStackPop(int *lineNumber, int *stmtNumber) {
     int bytesFreed = 2 * sizeof(uint16_t);
     // shift the variable table
     memmove(&mem[sysVARSTART]+bytesFreed, &mem[sysVARSTART], sysVAREND-sysVARSTART);
+    invalidateArrayCache();
     sysVARSTART += bytesFreed;
     sysVAREND += bytesFreed;
     sysGOSUBSTART = sysVAREND;
     return 1;
 }
 
+/* **************************************************************************
+ * DATA POINTER
+ * **************************************************************************/
+
+// The lexer has already turned DATA items into binary constants, so READ
+// just needs a pointer to the next one: the line it's in, and where it is in
+// that line. The program is only searched when a DATA statement runs out.
+static int dataLine, dataPos;	// dataPos 0 = search from the start of dataLine
+
+void restoreData(unsigned char *line) {
+    dataLine = line - &mem[0];
+    dataPos = 0;
+}
+
+// skip a token and any value that follows it
+unsigned char *skipToken(unsigned char *p) {
+    switch (*p++) {
+    case TOKEN_IDENT:
+        while (*p < 0x80)
+            p++;
+        return p + 1;
+    case TOKEN_NUMBER:
+        return p + sizeof(float);
+    case TOKEN_INTEGER:
+        return p + sizeof(long);
+    case TOKEN_STRING:
+        return p + strlen((char*)p) + 1;
+    default:
+        return p;
+    }
+}
+
+// find the next DATA item, or NULL if there are none left
+unsigned char *findDataItem() {
+    unsigned char *line = &mem[dataLine];
+    unsigned char *p = &mem[dataPos];
+    if (dataPos) {
+        if (*p == TOKEN_COMMA)
+            return p + 1;
+    }
+    else
+        p = line + 4;
+    while (line < &mem[sysPROGEND]) {
+        while (*p != TOKEN_EOL) {
+            if (*p == TOKEN_DATA) {
+                dataLine = line - &mem[0];
+                return p + 1;
+            }
+            p = skipToken(p);
+        }
+        line += *(uint16_t *)line;
+        p = line + 4;
+    }
+    restoreData(&mem[sysPROGEND]);
+    return NULL;
+}
+
+// push the next DATA item onto the calculator stack
+int readData(int isString) {
+    unsigned char *p = findDataItem();
+    if (p == NULL)
+        return ERROR_OUT_OF_DATA;
+    int ok;
+    if (*p == TOKEN_STRING) {
+        if (!isString) return ERROR_EXPR_EXPECTED_NUM;
+        ok = stackPushStr((char*)p + 1);
+    }
+    else {
+        float sign = 1.0f;
+        if (*p == TOKEN_MINUS) {
+            sign = -1.0f;
+            p++;
+        }
+        if (isString) return ERROR_EXPR_EXPECTED_STR;
+        if (*p == TOKEN_NUMBER)
+            ok = stackPushNum(sign * *(float*)(p + 1));
+        else if (*p == TOKEN_INTEGER)
+            ok = stackPushNum(sign * (float)*(long*)(p + 1));
+        else
+            return ERROR_UNEXPECTED_TOKEN;
+    }
+    if (!ok) return ERROR_OUT_OF_MEMORY;
+    dataPos = skipToken(p) - &mem[0];
+    return 0;
+}
+
+/* **************************************************************************
+ * EVENTS
+ * **************************************************************************/
+
+// The host queues the edges ON PIN asked for, from its pin change interrupt,
+// and ON TIMERs fall due by host_millis(). processInput() checks for an
+// event before each line or jump, and runs the handler as a GOSUB from the
+// statement it was about to execute. Events wait while a handler is running,
+// so handlers don't nest.
+static struct {
+    uint8_t pin;
+    uint16_t line;			// 0 = slot free
+} pinHandlers[PIN_EVENT_SLOTS];
+static struct {
+    uint16_t line;			// 0 = slot free
+    unsigned long period, due;	// ms
+} timers[EVENT_TIMERS];
+static int eventGosubDepth;	// gosub stack depth inside the running handler
+
+void clearTimers() {
+    for (int i = 0; i < EVENT_TIMERS; i++)
+        timers[i].line = 0;
+}
+
+// period 0 stops the timer
+int setTimer(unsigned long period, uint16_t line) {
+    int slot = -1;
+    for (int i = 0; i < EVENT_TIMERS; i++) {
+        if (timers[i].line == line) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && !timers[i].line)
+            slot = i;
+    }
+    if (!period) {
+        if (slot >= 0 && timers[slot].line == line)
+            timers[slot].line = 0;
+        return 1;
+    }
+    if (slot < 0)
+        return 0;
+    timers[slot].line = line;
+    timers[slot].period = period;
+    timers[slot].due = host_millis() + period;
+    return 1;
+}
+
+void clearEventHandlers() {
+    for (int i = 0; i < PIN_EVENT_SLOTS; i++) {
+        if (pinHandlers[i].line) {
+            host_watchPin(pinHandlers[i].pin, PIN_EVENT_OFF);
+            pinHandlers[i].line = 0;
+        }
+    }
+    while (host_getPinEvent() >= 0)
+        ;
+    clearTimers();
+    eventGosubDepth = 0;
+}
+
+// line 0 removes the handler
+int setPinHandler(int pin, int mode, uint16_t line) {
+    int slot = -1;
+    for (int i = 0; i < PIN_EVENT_SLOTS; i++) {
+        if (pinHandlers[i].line && pinHandlers[i].pin == pin) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 && !pinHandlers[i].line)
+            slot = i;
+    }
+    if (!line) {
+        if (slot >= 0 && pinHandlers[slot].line && pinHandlers[slot].pin == pin) {
+            host_watchPin(pin, PIN_EVENT_OFF);
+            pinHandlers[slot].line = 0;
+        }
+        return 1;
+    }
+    if (slot < 0 || !host_watchPin(pin, mode))
+        return 0;
+    pinHandlers[slot].pin = pin;
+    pinHandlers[slot].line = line;
+    return 1;
+}
+
+// the handler line for the next event, or 0 if there isn't one to run now
+uint16_t nextEventHandler() {
+    if (eventGosubDepth) {
+        if (sysGOSUBEND - sysGOSUBSTART >= eventGosubDepth)
+            return 0;	// still in the last handler
+        eventGosubDepth = 0;
+    }
+    // timers first, since pin events keep in the queue
+    unsigned long now = host_millis();
+    for (int i = 0; i < EVENT_TIMERS; i++) {
+        if (timers[i].line && (long)(now - timers[i].due) >= 0) {
+            // the next deadline is a whole number of periods on from this one,
+            // so a late handler doesn't make the timer drift, and periods
+            // that were missed altogether are skipped rather than run late
+            unsigned long period = timers[i].period;
+            timers[i].due += ((now - timers[i].due) / period + 1) * period;
+            return timers[i].line;
+        }
+    }
+    int pin;
+    while ((pin = host_getPinEvent()) >= 0) {
+        for (int i = 0; i < PIN_EVENT_SLOTS; i++) {
+            if (pinHandlers[i].line && pinHandlers[i].pin == pin)
+                return pinHandlers[i].line;
+        }
+    }
+    return 0;
+}
+
+/* **************************************************************************
+ * SAMPLING
+ * **************************************************************************/
+
+// SAMPLE has the host read the ADC from a timer interrupt into a small
+// queue, and processInput() copies the readings into the array between
+// lines. The interrupt can't write into the array itself, since GOSUB, DIM
+// and string assignments all move the variables about.
+static char sampleArray[MAX_IDENT_LEN+1];	// "" = not sampling
+static int sampleCount, sampleStored;	// sampleStored -1 = readings lost
+
+void stopSampling() {
+    if (sampleArray[0])
+        host_stopSampling();
+    sampleArray[0] = 0;
+}
+
+int startSampling(int pin, char *name, int count, unsigned long rate) {
+    stopSampling();
+    sampleStored = 0;
+    int numElements;
+    unsigned char *var = findArray(name, VAR_TYPE_NUM_ARRAY);
+    if (var == NULL)
+        return ERROR_VARIABLE_NOT_FOUND;
+    numArrayElems(var, name, &numElements);
+    if (count < 1 || count > numElements)
+        return ERROR_ARRAY_SUBSCRIPT_OUT_RANGE;
+    if (!host_startSampling(pin, rate))
+        return ERROR_BAD_PARAMETER;
+    strcpy(sampleArray, name);
+    sampleCount = count;
+    return ERROR_NONE;
+}
+
+// copy the waiting readings into the array
+void collectSamples() {
+    if (!sampleArray[0])
+        return;
+    int numElements = 0, reading;
+    float *elems = NULL;
+    unsigned char *var = findArray(sampleArray, VAR_TYPE_NUM_ARRAY);
+    if (var != NULL)
+        elems = numArrayElems(var, sampleArray, &numElements);
+    if (numElements < sampleCount) {
+        // the array was re-DIMmed smaller
+        sampleStored = -1;
+        stopSampling();
+        return;
+    }
+    while (sampleStored < sampleCount && (reading = host_getSample()) >= 0)
+        elems[sampleStored++] = reading;
+    // checked after taking the readings, so one dropped while they were
+    // being taken counts as well
+    if (host_samplesLost()) {
+        // a gap in the readings
+        sampleStored = -1;
+        stopSampling();
+    }
+    else if (sampleStored == sampleCount)
+        stopSampling();
+}
+
 /* **************************************************************************
  * LEXER
  * **************************************************************************/
@@ -775,41 +1047,29 @@ int nextToken()
         tokenOutLeft--;
         return -1;
     }
-    // Number: [0-9.]+
-    // TODO - handle 1e4 etc
-    if (isdigit(*tokenIn) || *tokenIn == '.') {   // Number: [0-9.]+
-        int gotDecimal = 0;
-        char numStr[MAX_NUMBER_LEN+1];
-        int numLen = 0;
-        do {
-            if (numLen == MAX_NUMBER_LEN) return ERROR_LEXER_BAD_NUM;
-            if (*tokenIn == '.') {
-                if (gotDecimal) return ERROR_LEXER_BAD_NUM;
-                else gotDecimal = 1;
-            }
-            numStr[numLen++] = *tokenIn++;
-        } 
-        while (isdigit(*tokenIn) || *tokenIn == '.');
-
-        numStr[numLen] = 0;
+    // Number: [0-9]*[.][0-9]*, with an optional exponent e.g. 1.5e-3
+    if (isdigit(*tokenIn) || *tokenIn == '.') {
+        const char *numEnd;
+        float f = host_strToFloat((char*)tokenIn, &numEnd);
+        if (numEnd == (char*)tokenIn || *numEnd == '.') return ERROR_LEXER_BAD_NUM;
         if (tokenOutLeft <= 5) return ERROR_LEXER_TOO_LONG;
         tokenOutLeft -= 5;
-        if (!gotDecimal) {
-            long val = strtol(numStr, 0, 10);
-            if (val == LONG_MAX || val == LONG_MIN)
-                gotDecimal = true;
-            else {
-                *tokenOut++ = TOKEN_INTEGER;
-                *(long*)tokenOut = (long)val;
-                tokenOut += sizeof(long);
-            }
+        // keep plain integers exact, if they fit in a long
+        unsigned long val = 0;
+        unsigned char *p = tokenIn;
+        while (isdigit(*p) && (val < LONG_MAX / 10 || (val == LONG_MAX / 10 && *p - '0' <= LONG_MAX % 10)))
+            val = val * 10 + (*p++ - '0');
+        if ((char*)p == numEnd) {
+            *tokenOut++ = TOKEN_INTEGER;
+            *(long*)tokenOut = (long)val;
+            tokenOut += sizeof(long);
         }
-        if (gotDecimal)
-        {
+        else {
             *tokenOut++ = TOKEN_NUMBER;
-            *(float*)tokenOut = (float)strtod(numStr, 0);
+            *(float*)tokenOut = f;
             tokenOut += sizeof(float);
         }
+        tokenIn = (unsigned char*)numEnd;
         return 0;
     }
     // identifier: [a-zA-Z][a-zA-Z0-9]*[$]
@@ -999,6 +1259,53 @@ int parseSubscriptExpr() {
     return 0;
 }
 
+// parse (x1,....xn) for an element of an existing array e.g. a(i,j)
+// Each index is folded into the element offset as soon as it's evaluated, so
+// nothing is left on the calculator stack. Sets *pVar to the array variable and
+// *pElems to its elements (in execute mode only).
+int parseArrayElement(char *name, int type, unsigned char **pVar, unsigned char **pElems, int *pOffset) {
+    uint16_t *dims = NULL;
+    int numDims = 0, numDimsGiven = 0;
+    int offset = 0, error = 0;
+    if (executeMode) {
+        *pVar = findArray(name, type);
+        if (*pVar == NULL) return ERROR_VARIABLE_NOT_FOUND;
+        dims = (uint16_t *)(*pVar + 3 + strlen(name) + 1);
+        numDims = *dims++;
+    }
+    if (curToken != TOKEN_LBRACKET) return ERROR_EXPR_MISSING_BRACKET;
+    getNextToken();
+    while(1) {
+        int val = expectNumber();
+        if (val) return val;	// error
+        if (executeMode && numDimsGiven < numDims) {
+            // dims are stored last first, and the last index varies fastest
+            int index = (int)stackPopNum();
+            int dim = dims[numDims - 1 - numDimsGiven];
+            if (index < 1 || index > dim)
+                error = ERROR_ARRAY_SUBSCRIPT_OUT_RANGE;
+            offset = offset * dim + index - 1;
+        }
+        else if (executeMode)
+            stackPopNum();
+        numDimsGiven++;
+        if (curToken == TOKEN_RBRACKET)
+            break;
+        else if (curToken == TOKEN_COMMA)
+            getNextToken();
+        else
+            return ERROR_EXPR_MISSING_BRACKET;
+    }
+    getNextToken(); // eat )
+    if (executeMode) {
+        if (numDimsGiven != numDims) return ERROR_WRONG_ARRAY_DIMENSIONS;
+        if (error) return error;
+        *pElems = (unsigned char *)(dims + numDims);
+        *pOffset = offset;
+    }
+    return 0;
+}
+
 // parse a function call e.g. LEN(a$)
 int parseFnCallExpr() {
     int op = curToken;
@@ -1047,7 +1354,19 @@ int parseFnCallExpr() {
             break;
         case TOKEN_VAL:
             {
-                // tokenise str onto the stack
+                // a plain number is read directly
+                const char *str = stackGetStr(), *numEnd;
+                float num = host_strToFloat(str, &numEnd);
+                if (numEnd != str) {
+                    while (isspace(*numEnd))
+                        numEnd++;
+                    if (!*numEnd) {
+                        stackPopStr();
+                        stackPushNum(num);
+                        break;
+                    }
+                }
+                // anything else is tokenised onto the stack and evaluated
                 int oldStackEnd = sysSTACKEND;
                 unsigned char *oldTokenBuffer = prevToken;
                 int val = tokenize((unsigned char*)stackGetStr(), &mem[sysSTACKEND], sysVARSTART - sysSTACKEND);
@@ -1106,6 +1425,44 @@ int parseFnCallExpr() {
             tmp = (int)stackPopNum();
             if (!stackPushNum(host_analogRead(tmp))) return ERROR_OUT_OF_MEMORY;
             break;
+        case TOKEN_PINLOST:
+            tmp = (int)stackPopNum();
+            if (!stackPushNum(host_pinEventsDropped(tmp))) return ERROR_OUT_OF_MEMORY;
+            break;
+        case TOKEN_PORTIN:
+            tmp = host_portIn((int)stackPopNum());
+            if (tmp < 0) return ERROR_BAD_PARAMETER;
+            if (!stackPushNum(tmp)) return ERROR_OUT_OF_MEMORY;
+            break;
+        case TOKEN_ABS:
+            stackPushNum((float)fabs(stackPopNum()));
+            break;
+        case TOKEN_SQR:
+            {
+                float f = stackPopNum();
+                if (f < 0) return ERROR_BAD_PARAMETER;
+                stackPushNum((float)sqrt(f));
+            }
+            break;
+        case TOKEN_SIN:
+            stackPushNum(mathSin(stackPopNum()));
+            break;
+        case TOKEN_COS:
+            stackPushNum(mathCos(stackPopNum()));
+            break;
+        case TOKEN_ATN:
+            stackPushNum(mathAtan(stackPopNum()));
+            break;
+        case TOKEN_EXP:
+            stackPushNum(mathExp(stackPopNum()));
+            break;
+        case TOKEN_LOG:
+            {
+                float f = stackPopNum();
+                if (f <= 0) return ERROR_BAD_PARAMETER;
+                stackPushNum(mathLog(f));
+            }
+            break;
         default:
             return ERROR_UNEXPECTED_TOKEN;
         }
@@ -1124,20 +1481,16 @@ int parseIdentifierExpr() {
     getNextToken();	// eat ident
     if (curToken == TOKEN_LBRACKET) {
         // array access
-        int val = parseSubscriptExpr();
+        unsigned char *var, *elems;
+        int offset;
+        int val = parseArrayElement(ident, isStringIdentifier ? VAR_TYPE_STR_ARRAY : VAR_TYPE_NUM_ARRAY, &var, &elems, &offset);
         if (val) return val;
         if (executeMode) {
             if (isStringIdentifier) {
-                int error = 0;
-                char *str = lookupStrArrayElem(ident, &error);
-                if (error) return error;
-                else if (!stackPushStr(str)) return ERROR_OUT_OF_MEMORY;
+                if (!stackPushStr(lookupStrArrayElem(elems, offset))) return ERROR_OUT_OF_MEMORY;
             }
             else {
-                int error = 0;
-                float f = lookupNumArrayElem(ident, &error);
-                if (error) return error;
-                else if (!stackPushNum(f)) return ERROR_OUT_OF_MEMORY;
+                if (!stackPushNum(lookupNumArrayElem(elems, offset))) return ERROR_OUT_OF_MEMORY;
             }
         }
     }
@@ -1185,6 +1538,16 @@ int parse_RND() {
     return TYPE_NUMBER;	
 }
 
+int parse_SAMPLED() {
+    getNextToken();
+    if (executeMode) {
+        collectSamples();
+        if (!stackPushNum(sampleStored))
+            return ERROR_OUT_OF_MEMORY;
+    }
+    return TYPE_NUMBER;
+}
+
 int parse_INKEY() {
     getNextToken();
     if (executeMode) {
@@ -1235,6 +1598,8 @@ int parsePrimary() {
         return parse_RND();
     case TOKEN_INKEY:
         return parse_INKEY();
+    case TOKEN_SAMPLED:
+        return parse_SAMPLED();
 
         // unary ops
     case TOKEN_MINUS:
@@ -1251,6 +1616,15 @@ int parsePrimary() {
     case TOKEN_MID: 
     case TOKEN_PINREAD:
     case TOKEN_ANALOGRD:
+    case TOKEN_PINLOST:
+    case TOKEN_PORTIN:
+    case TOKEN_ABS:
+    case TOKEN_SQR:
+    case TOKEN_SIN:
+    case TOKEN_COS:
+    case TOKEN_ATN:
+    case TOKEN_EXP:
+    case TOKEN_LOG:
         return parseFnCallExpr();
 
     default:
@@ -1408,6 +1782,10 @@ int parse_RUN() {
     if (executeMode) {
         // clear variables
         sysVARSTART = sysVAREND = sysGOSUBSTART = sysGOSUBEND = MEMORY_SIZE;
+        invalidateArrayCache();
+        restoreData(&mem[0]);
+        clearEventHandlers();
+        stopSampling();
         jumpLineNumber = startLine;
         stopLineNumber = stopStmtNumber = 0;
     }
@@ -1435,6 +1813,12 @@ int parse_PAUSE() {
         long ms = (long)stackPopNum();
         if (ms < 0)
             return ERROR_BAD_PARAMETER;
+        // a short step at a time while SAMPLE's readings need collecting
+        while (sampleArray[0] && ms > 0) {
+            host_sleep(1);
+            ms--;
+            collectSamples();
+        }
         host_sleep(ms);
     }
     return 0;
@@ -1520,8 +1904,100 @@ int parseTwoIntCmd() {
     return 0;
 }
 
-// this handles both LET a$="hello" and INPUT a$ type assignments
-int parseAssignment(bool inputStmt) {
+// SAMPLE pin, array, count, rate
+int parse_SAMPLE() {
+    char ident[MAX_IDENT_LEN+1];
+    getNextToken();	// eat SAMPLE
+    int val = expectNumber();
+    if (val) return val;	// error
+    if (curToken != TOKEN_COMMA) return ERROR_UNEXPECTED_TOKEN;
+    getNextToken();
+    if (curToken != TOKEN_IDENT || isStrIdent) return ERROR_UNEXPECTED_TOKEN;
+    if (executeMode)
+        strcpy(ident, identVal);
+    getNextToken();	// eat ident
+    if (curToken != TOKEN_COMMA) return ERROR_UNEXPECTED_TOKEN;
+    getNextToken();
+    val = expectNumber();
+    if (val) return val;	// error
+    if (curToken != TOKEN_COMMA) return ERROR_UNEXPECTED_TOKEN;
+    getNextToken();
+    val = expectNumber();
+    if (val) return val;	// error
+    if (executeMode) {
+        float rate = stackPopNum();
+        int count = (int)stackPopNum();
+        int pin = (int)stackPopNum();
+        if (rate < 1 || rate >= LONG_MAX)
+            return ERROR_BAD_PARAMETER;
+        return startSampling(pin, ident, count, (unsigned long)rate);
+    }
+    return 0;
+}
+
+// PORTOUT port, mask, value
+int parse_PORTOUT() {
+    getNextToken();	// eat PORTOUT
+    for (int i = 0; i < 3; i++) {
+        if (i) {
+            if (curToken != TOKEN_COMMA) return ERROR_UNEXPECTED_TOKEN;
+            getNextToken();
+        }
+        int val = expectNumber();
+        if (val) return val;	// error
+    }
+    if (executeMode) {
+        int value = (int)stackPopNum();
+        int mask = (int)stackPopNum();
+        if (!host_portOut((int)stackPopNum(), mask, value))
+            return ERROR_BAD_PARAMETER;
+    }
+    return 0;
+}
+
+// SHIFTOUT dataPin, clockPin, bitOrder, array, count
+int parse_SHIFTOUT() {
+    char ident[MAX_IDENT_LEN+1];
+    getNextToken();	// eat SHIFTOUT
+    for (int i = 0; i < 3; i++) {
+        int val = expectNumber();
+        if (val) return val;	// error
+        if (curToken != TOKEN_COMMA) return ERROR_UNEXPECTED_TOKEN;
+        getNextToken();
+    }
+    if (curToken != TOKEN_IDENT || isStrIdent) return ERROR_UNEXPECTED_TOKEN;
+    if (executeMode)
+        strcpy(ident, identVal);
+    getNextToken();	// eat ident
+    if (curToken != TOKEN_COMMA) return ERROR_UNEXPECTED_TOKEN;
+    getNextToken();
+    int val = expectNumber();
+    if (val) return val;	// error
+    if (executeMode) {
+        int count = (int)stackPopNum();
+        int bitOrder = (int)stackPopNum();
+        int clockPin = (int)stackPopNum();
+        int dataPin = (int)stackPopNum();
+        unsigned char *var = findArray(ident, VAR_TYPE_NUM_ARRAY);
+        if (var == NULL)
+            return ERROR_VARIABLE_NOT_FOUND;
+        int numElements;
+        float *elems = numArrayElems(var, ident, &numElements);
+        if (count < 0 || count > numElements)
+            return ERROR_ARRAY_SUBSCRIPT_OUT_RANGE;
+        if (!host_shiftOut(dataPin, clockPin, bitOrder, elems, count))
+            return ERROR_BAD_PARAMETER;
+    }
+    return 0;
+}
+
+// where parseAssignment gets the value from
+#define ASSIGN_LET		0
+#define ASSIGN_INPUT	1
+#define ASSIGN_READ		2
+
+// this handles LET a$="hello", INPUT a$ and READ a$ type assignments
+int parseAssignment(int from) {
     char ident[MAX_IDENT_LEN+1];
     int val;
     if (curToken != TOKEN_IDENT) return ERROR_UNEXPECTED_TOKEN;
@@ -1529,14 +2005,16 @@ int parseAssignment(bool inputStmt) {
         strcpy(ident, identVal);
     int isStringIdentifier = isStrIdent;
     int isArray = 0;
+    unsigned char *var, *elems;
+    int offset;
     getNextToken();	// eat ident
     if (curToken == TOKEN_LBRACKET) {
         // array element being set
-        val = parseSubscriptExpr();
+        val = parseArrayElement(ident, isStringIdentifier ? VAR_TYPE_STR_ARRAY : VAR_TYPE_NUM_ARRAY, &var, &elems, &offset);
         if (val) return val;
         isArray = 1;
     }
-    if (inputStmt) {
+    if (from == ASSIGN_INPUT) {
         // from INPUT statement
         if (executeMode) {
             char *inputStr = host_readLine();
@@ -1544,7 +2022,7 @@ int parseAssignment(bool inputStmt) {
                 if (!stackPushStr(inputStr)) return ERROR_OUT_OF_MEMORY;
             }
             else {
-                float f = (float)strtod(inputStr, 0);
+                float f = host_strToFloat(inputStr, 0);
                 if (!stackPushNum(f)) return ERROR_OUT_OF_MEMORY;
             }
             host_newLine();
@@ -1552,6 +2030,14 @@ int parseAssignment(bool inputStmt) {
         }
         val = isStringIdentifier ? TYPE_STRING : TYPE_NUMBER;
     }
+    else if (from == ASSIGN_READ) {
+        // from READ statement
+        if (executeMode) {
+            val = readData(isStringIdentifier);
+            if (val) return val;
+        }
+        val = isStringIdentifier ? TYPE_STRING : TYPE_NUMBER;
+    }
     else {
         // from LET statement
         if (curToken != TOKEN_EQUALS) return ERROR_UNEXPECTED_TOKEN;
@@ -1565,8 +2051,7 @@ int parseAssignment(bool inputStmt) {
         if (!IS_TYPE_NUM(val)) return ERROR_EXPR_EXPECTED_NUM;
         if (executeMode) {
             if (isArray) {
-                val = setNumArrayElem(ident, stackPopNum());
-                if (val) return val;
+                setNumArrayElem(elems, offset, stackPopNum());
             }
             else {
                 if (!storeNumVariable(ident, stackPopNum())) return ERROR_OUT_OF_MEMORY;
@@ -1578,11 +2063,9 @@ int parseAssignment(bool inputStmt) {
         if (!IS_TYPE_STR(val)) return ERROR_EXPR_EXPECTED_STR;
         if (executeMode) {
             if (isArray) {
-                // annoyingly, we've got the string at the top of the stack
-                // (from parseExpression) and the array index stuff (from
-                // parseSubscriptExpr) underneath.
-                val = setStrArrayElem(ident);
+                val = setStrArrayElem(var, elems, offset, stackGetStr());
                 if (val) return val;
+                stackPopStr();
             }
             else {
                 if (!storeStrVariable(ident, stackGetStr())) return ERROR_OUT_OF_MEMORY;
@@ -1680,6 +2163,69 @@ int parse_GOSUB() {
     return 0;
 }
 
+// ON TIMER ms GOSUB line, or ON TIMER OFF
+int parseOnTimer() {
+    getNextToken();	// eat TIMER
+    if (curToken == TOKEN_OFF) {
+        getNextToken();
+        if (executeMode)
+            clearTimers();
+        return 0;
+    }
+    int val = expectNumber();
+    if (val) return val;	// error
+    if (curToken != TOKEN_GOSUB) return ERROR_UNEXPECTED_TOKEN;
+    getNextToken();	// eat GOSUB
+    val = expectNumber();
+    if (val) return val;	// error
+    if (executeMode) {
+        uint16_t line = (uint16_t)stackPopNum();
+        if (line <= 0)
+            return ERROR_BAD_LINE_NUM;
+        float period = stackPopNum();
+        if (period < 0 || period >= LONG_MAX || !setTimer((unsigned long)period, line))
+            return ERROR_BAD_PARAMETER;
+    }
+    return 0;
+}
+
+// ON PIN n RISING|FALLING|CHANGE GOSUB line, ON PIN n OFF or ON TIMER ...
+int parse_ON() {
+    getNextToken();	// eat ON
+    if (curToken == TOKEN_TIMER)
+        return parseOnTimer();
+    if (curToken != TOKEN_PIN) return ERROR_UNEXPECTED_TOKEN;
+    getNextToken();	// eat PIN
+    int val = expectNumber();
+    if (val) return val;	// error
+    int mode;
+    switch (curToken) {
+    case TOKEN_RISING: mode = PIN_EVENT_RISING; break;
+    case TOKEN_FALLING: mode = PIN_EVENT_FALLING; break;
+    case TOKEN_CHANGE: mode = PIN_EVENT_CHANGE; break;
+    case TOKEN_OFF: mode = PIN_EVENT_OFF; break;
+    default: return ERROR_UNEXPECTED_TOKEN;
+    }
+    getNextToken();
+    uint16_t line = 0;
+    if (mode != PIN_EVENT_OFF) {
+        if (curToken != TOKEN_GOSUB) return ERROR_UNEXPECTED_TOKEN;
+        getNextToken();	// eat GOSUB
+        val = expectNumber();
+        if (val) return val;	// error
+        if (executeMode) {
+            line = (uint16_t)stackPopNum();
+            if (line <= 0)
+                return ERROR_BAD_LINE_NUM;
+        }
+    }
+    if (executeMode) {
+        if (!setPinHandler((int)stackPopNum(), mode, line))
+            return ERROR_BAD_PARAMETER;
+    }
+    return 0;
+}
+
 // LOAD or LOAD "x"
 // SAVE, SAVE+ or SAVE "x"
 // DELETE "x"
@@ -1792,6 +2338,53 @@ int parse_DIM() {
     return 0;
 }
 
+// DATA 1, -2.5, "three"
+int parse_DATA() {
+    getNextToken();	// eat DATA
+    while (1) {
+        if (curToken == TOKEN_MINUS) {
+            getNextToken();
+            if (curToken != TOKEN_NUMBER && curToken != TOKEN_INTEGER)
+                return ERROR_EXPR_EXPECTED_NUM;
+        }
+        else if (curToken != TOKEN_NUMBER && curToken != TOKEN_INTEGER && curToken != TOKEN_STRING)
+            return ERROR_UNEXPECTED_TOKEN;
+        getNextToken();	// the items are read by READ, not here
+        if (curToken != TOKEN_COMMA)
+            break;
+        getNextToken();	// eat ,
+    }
+    return 0;
+}
+
+// READ a, b$, c(i)
+int parse_READ() {
+    getNextToken();	// eat READ
+    while (1) {
+        int val = parseAssignment(ASSIGN_READ);
+        if (val) return val;
+        if (curToken != TOKEN_COMMA)
+            break;
+        getNextToken();	// eat ,
+    }
+    return 0;
+}
+
+// RESTORE or RESTORE n
+int parse_RESTORE() {
+    getNextToken();	// eat RESTORE
+    uint16_t line = 0;
+    if (curToken != TOKEN_EOL && curToken != TOKEN_CMD_SEP) {
+        int val = expectNumber();
+        if (val) return val;	// error
+        if (executeMode)
+            line = (uint16_t)stackPopNum();
+    }
+    if (executeMode)
+        restoreData(findProgLine(line));
+    return 0;
+}
+
 static int targetStmtNumber;
 int parseStmts()
 {
@@ -1808,9 +2401,9 @@ int parseStmts()
         int needCmdSep = 1;
         switch (curToken) {
         case TOKEN_PRINT: ret = parse_PRINT(); break;
-        case TOKEN_LET: getNextToken(); ret = parseAssignment(false); break;
-        case TOKEN_IDENT: ret = parseAssignment(false); break;
-        case TOKEN_INPUT: getNextToken(); ret = parseAssignment(true); break;
+        case TOKEN_LET: getNextToken(); ret = parseAssignment(ASSIGN_LET); break;
+        case TOKEN_IDENT: ret = parseAssignment(ASSIGN_LET); break;
+        case TOKEN_INPUT: getNextToken(); ret = parseAssignment(ASSIGN_INPUT); break;
         case TOKEN_LIST: ret = parse_LIST(); break;
         case TOKEN_RUN: ret = parse_RUN(); break;
         case TOKEN_GOTO: ret = parse_GOTO(); break;
@@ -1819,8 +2412,15 @@ int parseStmts()
         case TOKEN_FOR: ret = parse_FOR(); break;
         case TOKEN_NEXT: ret = parse_NEXT(); break;
         case TOKEN_GOSUB: ret = parse_GOSUB(); break;
+        case TOKEN_ON: ret = parse_ON(); break;
         case TOKEN_DIM: ret = parse_DIM(); break;
         case TOKEN_PAUSE: ret = parse_PAUSE(); break;
+        case TOKEN_DATA: ret = parse_DATA(); break;
+        case TOKEN_READ: ret = parse_READ(); break;
+        case TOKEN_RESTORE: ret = parse_RESTORE(); break;
+        case TOKEN_SAMPLE: ret = parse_SAMPLE(); break;
+        case TOKEN_PORTOUT: ret = parse_PORTOUT(); break;
+        case TOKEN_SHIFTOUT: ret = parse_SHIFTOUT(); break;
         
         case TOKEN_LOAD:
         case TOKEN_SAVE:
@@ -1958,6 +2558,28 @@ int processInput(unsigned char *tokenBuf) {
             if (jumpStmtNumber)
                 targetStmtNumber = jumpStmtNumber;
 
+            collectSamples();
+
+            // run any event handler first, as a GOSUB from the statement about
+            // to execute. RETURN resumes at the statement after the one pushed,
+            // and a target of 0 is pushed as 65535 which wraps back round to 0.
+            if (lineNumber) {
+                uint16_t handlerLine = nextEventHandler();
+                if (handlerLine) {
+                    if (!gosubStackPush(lineNumber, targetStmtNumber - 1)) {
+                        ret = ERROR_OUT_OF_MEMORY;
+                        break;
+                    }
+                    eventGosubDepth = sysGOSUBEND - sysGOSUBSTART;
+                    p = findProgLine(handlerLine);
+                    if (p == &mem[sysPROGEND])
+                        break;	// end of program
+                    lineNumber = *(uint16_t*)(p+2);
+                    tokenBuffer = p+4;
+                    targetStmtNumber = 0;
+                }
+            }
+
             if (host_ESCPressed())
             { 
                 ret = ERROR_BREAK_PRESSED; 
@@ -1975,6 +2597,10 @@ void reset() {
     sysSTACKSTART = sysSTACKEND = sysPROGEND;
     // variables/gosub stack at the end of memory
     sysVARSTART = sysVAREND = sysGOSUBSTART = sysGOSUBEND = MEMORY_SIZE;
+    invalidateArrayCache();
+    restoreData(&mem[0]);
+    clearEventHandlers();
+    stopSampling();
     memset(&mem[0], 0, MEMORY_SIZE);
 
     stopLineNumber = 0;
@@ -67,9 +67,31 @@
 #define TOKEN_ANALOGRD          63
 #define TOKEN_DIR               64
 #define TOKEN_DELETE            65
+#define TOKEN_DATA              66
+#define TOKEN_READ              67
+#define TOKEN_RESTORE           68
+#define TOKEN_ABS               69
+#define TOKEN_SQR               70
+#define TOKEN_SIN               71
+#define TOKEN_COS               72
+#define TOKEN_ATN               73
+#define TOKEN_EXP               74
+#define TOKEN_LOG               75
+#define TOKEN_ON                76
+#define TOKEN_RISING            77
+#define TOKEN_FALLING           78
+#define TOKEN_CHANGE            79
+#define TOKEN_OFF               80
+#define TOKEN_PINLOST           81
+#define TOKEN_TIMER             82
+#define TOKEN_SAMPLE            83
+#define TOKEN_SAMPLED           84
+#define TOKEN_PORTOUT           85
+#define TOKEN_PORTIN            86
+#define TOKEN_SHIFTOUT          87
 
 #define FIRST_IDENT_TOKEN 23
-#define LAST_IDENT_TOKEN 65
+#define LAST_IDENT_TOKEN 87
 
 #define FIRST_NON_ALPHA_TOKEN    8
 #define LAST_NON_ALPHA_TOKEN    22
@@ -101,9 +123,10 @@
 #define ERROR_STR_SUBSCRIPT_OUT_RANGE	        22
 #define ERROR_IN_VAL_INPUT			23
 #define ERROR_BAD_PARAMETER                     24
+#define ERROR_OUT_OF_DATA                       25
 
 #define MAX_IDENT_LEN	8
-#define MAX_NUMBER_LEN	10
+#define EVENT_TIMERS	4	// ON TIMERs running at once
 
 #define MEMORY_SIZE	1024
 extern unsigned char mem[];
@@ -11,4 +11,8 @@
 ///////////// Misc. /////////////
 //#define BUZZER_IN_USE
 
+// SIN, COS, ATN, EXP and LOG on AVR: 0 = avr-libc, 1 = lookup tables
+// (fastest, about 4 digits), 2 = polynomials (full float accuracy)
+#define MATH_PRECISION 2
+
 #endif /* _CONFIG_H_ */
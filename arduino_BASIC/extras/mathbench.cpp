@@ -0,0 +1,83 @@
+// Accuracy and speed of the fastmath.cpp kernels against libm, run on a PC:
+//
+//    g++ -O2 -o mathbench mathbench.cpp ../fastmath.cpp -lm
+//    ./mathbench
+//
+// Errors are measured against the double precision libm functions, as the
+// largest absolute error and the largest error relative to the result.
+// Timings are per call on the host, so only the ratios between kernels mean
+// anything for the AVR.
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "../fastmath.h"
+
+#define SAMPLES     200000
+#define TIME_LOOPS  20
+
+typedef float (*Kernel)(float);
+
+struct Function {
+    const char *name;
+    double (*reference)(double);
+    float lo, hi;
+    Kernel kernels[3];
+};
+
+static float libmSin(float x) { return sinf(x); }
+static float libmCos(float x) { return cosf(x); }
+static float libmAtan(float x) { return atanf(x); }
+static float libmExp(float x) { return expf(x); }
+static float libmLog(float x) { return logf(x); }
+
+static const char *kernelNames[3] = { "libm", "table", "poly" };
+
+static const Function functions[] = {
+    { "SIN", sin, -100.0f, 100.0f, { libmSin, tableSin, polySin } },
+    { "COS", cos, -100.0f, 100.0f, { libmCos, tableCos, polyCos } },
+    { "ATN", atan, -50.0f, 50.0f, { libmAtan, tableAtan, polyAtan } },
+    { "EXP", exp, -80.0f, 80.0f, { libmExp, tableExp, polyExp } },
+    { "LOG", log, 1e-6f, 1e6f, { libmLog, tableLog, polyLog } },
+};
+
+static float inputs[SAMPLES];
+volatile float sink;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main() {
+    printf("%-4s %-6s %12s %12s %10s\n", "fn", "kernel", "max abs err", "max rel err", "ns/call");
+    for (unsigned f = 0; f < sizeof(functions) / sizeof(functions[0]); f++) {
+        const Function *fn = &functions[f];
+        for (int i = 0; i < SAMPLES; i++)
+            inputs[i] = fn->lo + (fn->hi - fn->lo) * i / (SAMPLES - 1);
+
+        for (int k = 0; k < 3; k++) {
+            Kernel kernel = fn->kernels[k];
+            double maxAbs = 0, maxRel = 0;
+            for (int i = 0; i < SAMPLES; i++) {
+                double want = fn->reference(inputs[i]);
+                double err = fabs(kernel(inputs[i]) - want);
+                if (err > maxAbs) maxAbs = err;
+                if (want != 0 && err / fabs(want) > maxRel) maxRel = err / fabs(want);
+            }
+
+            double start = now();
+            float sum = 0;
+            for (int n = 0; n < TIME_LOOPS; n++) {
+                for (int i = 0; i < SAMPLES; i++)
+                    sum += kernel(inputs[i]);
+            }
+            sink = sum;
+            double ns = (now() - start) * 1e9 / ((double)TIME_LOOPS * SAMPLES);
+
+            printf("%-4s %-6s %12.3g %12.3g %10.1f\n", fn->name, kernelNames[k], maxAbs, maxRel, ns);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include "fastmath.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_float
+#define pgm_read_float(p) (*(p))
+#endif
+#endif
+
+#define MATH_HALF_PI        1.57079632679f
+#define MATH_QUARTER_PI     0.78539816340f
+#define MATH_TWO_OVER_PI    0.63661977237f
+#define MATH_LOG2E          1.44269504089f
+#define MATH_LN2            0.69314718056f
+
+/* **************************************************************************
+ * TABLE KERNELS
+ * **************************************************************************/
+
+// sin(x) for x = 0 to PI/2 in 64 steps
+static const float sinTable[] PROGMEM = {
+    0.00000000e+00f, 2.45412285e-02f, 4.90676743e-02f, 7.35645636e-02f, 9.80171403e-02f, 1.22410675e-01f,
+    1.46730474e-01f, 1.70961889e-01f, 1.95090322e-01f, 2.19101240e-01f, 2.42980180e-01f, 2.66712757e-01f,
+    2.90284677e-01f, 3.13681740e-01f, 3.36889853e-01f, 3.59895037e-01f, 3.82683432e-01f, 4.05241314e-01f,
+    4.27555093e-01f, 4.49611330e-01f, 4.71396737e-01f, 4.92898192e-01f, 5.14102744e-01f, 5.34997620e-01f,
+    5.55570233e-01f, 5.75808191e-01f, 5.95699304e-01f, 6.15231591e-01f, 6.34393284e-01f, 6.53172843e-01f,
+    6.71558955e-01f, 6.89540545e-01f, 7.07106781e-01f, 7.24247083e-01f, 7.40951125e-01f, 7.57208847e-01f,
+    7.73010453e-01f, 7.88346428e-01f, 8.03207531e-01f, 8.17584813e-01f, 8.31469612e-01f, 8.44853565e-01f,
+    8.57728610e-01f, 8.70086991e-01f, 8.81921264e-01f, 8.93224301e-01f, 9.03989293e-01f, 9.14209756e-01f,
+    9.23879533e-01f, 9.32992799e-01f, 9.41544065e-01f, 9.49528181e-01f, 9.56940336e-01f, 9.63776066e-01f,
+    9.70031253e-01f, 9.75702130e-01f, 9.80785280e-01f, 9.85277642e-01f, 9.89176510e-01f, 9.92479535e-01f,
+    9.95184727e-01f, 9.97290457e-01f, 9.98795456e-01f, 9.99698819e-01f, 1.00000000e+00f
+};
+
+// atan(x) for x = 0 to 1 in 32 steps
+static const float atanTable[] PROGMEM = {
+    0.00000000e+00f, 3.12398334e-02f, 6.24188100e-02f, 9.34767812e-02f, 1.24354995e-01f, 1.54996742e-01f,
+    1.85347950e-01f, 2.15357700e-01f, 2.44978663e-01f, 2.74167451e-01f, 3.02884868e-01f, 3.31096077e-01f,
+    3.58770670e-01f, 3.85882669e-01f, 4.12410442e-01f, 4.38336560e-01f, 4.63647609e-01f, 4.88333951e-01f,
+    5.12389460e-01f, 5.35811238e-01f, 5.58599315e-01f, 5.80756354e-01f, 6.02287346e-01f, 6.23199330e-01f,
+    6.43501109e-01f, 6.63202993e-01f, 6.82316555e-01f, 7.00854408e-01f, 7.18830000e-01f, 7.36257429e-01f,
+    7.53151281e-01f, 7.69526480e-01f, 7.85398163e-01f
+};
+
+// 2^x for x = 0 to 1 in 32 steps
+static const float exp2Table[] PROGMEM = {
+    1.00000000e+00f, 1.02189715e+00f, 1.04427378e+00f, 1.06714040e+00f, 1.09050773e+00f, 1.11438674e+00f,
+    1.13878863e+00f, 1.16372486e+00f, 1.18920712e+00f, 1.21524736e+00f, 1.24185781e+00f, 1.26905096e+00f,
+    1.29683955e+00f, 1.32523664e+00f, 1.35425555e+00f, 1.38390988e+00f, 1.41421356e+00f, 1.44518081e+00f,
+    1.47682615e+00f, 1.50916443e+00f, 1.54221083e+00f, 1.57598085e+00f, 1.61049033e+00f, 1.64575548e+00f,
+    1.68179283e+00f, 1.71861930e+00f, 1.75625216e+00f, 1.79470908e+00f, 1.83400809e+00f, 1.87416763e+00f,
+    1.91520656e+00f, 1.95714412e+00f, 2.00000000e+00f
+};
+
+// log2(x) for x = 1 to 2 in 32 steps
+static const float log2Table[] PROGMEM = {
+    0.00000000e+00f, 4.43941194e-02f, 8.74628413e-02f, 1.29283017e-01f, 1.69925001e-01f, 2.09453366e-01f,
+    2.47927513e-01f, 2.85402219e-01f, 3.21928095e-01f, 3.57552005e-01f, 3.92317423e-01f, 4.26264755e-01f,
+    4.59431619e-01f, 4.91853096e-01f, 5.23561956e-01f, 5.54588852e-01f, 5.84962501e-01f, 6.14709844e-01f,
+    6.43856190e-01f, 6.72425342e-01f, 7.00439718e-01f, 7.27920455e-01f, 7.54887502e-01f, 7.81359714e-01f,
+    8.07354922e-01f, 8.32890014e-01f, 8.57980995e-01f, 8.82643049e-01f, 9.06890596e-01f, 9.30737338e-01f,
+    9.54196310e-01f, 9.77279923e-01f, 1.00000000e+00f
+};
+
+// linear interpolation in a table, pos counted in table steps
+static float interpolate(const float *table, int steps, float pos) {
+    int i = (int)pos;
+    if (i >= steps)
+        i = steps - 1;
+    float a = pgm_read_float(&table[i]);
+    float b = pgm_read_float(&table[i+1]);
+    return a + (b - a) * (pos - i);
+}
+
+// sin of t quarter turns
+static float tableSinQuarters(float t) {
+    float q = floor(t);
+    float f = t - q;
+    int quadrant = (int)(q - 4.0f * floor(q * 0.25f));
+    if (quadrant & 1)
+        f = 1.0f - f;
+    float s = interpolate(sinTable, 64, f * 64);
+    return (quadrant & 2) ? -s : s;
+}
+
+float tableSin(float x) {
+    return tableSinQuarters(x * MATH_TWO_OVER_PI);
+}
+
+float tableCos(float x) {
+    return tableSinQuarters(x * MATH_TWO_OVER_PI + 1.0f);
+}
+
+float tableAtan(float x) {
+    float a = fabs(x);
+    float r;
+    if (a <= 1.0f)
+        r = interpolate(atanTable, 32, a * 32);
+    else
+        r = MATH_HALF_PI - interpolate(atanTable, 32, 32 / a);
+    return (x < 0.0f) ? -r : r;
+}
+
+float tableExp(float x) {
+    if (x > 88.7228f) return INFINITY;
+    if (x < -87.3365f) return 0.0f;
+    // e^x = 2^n * 2^f
+    float t = x * MATH_LOG2E;
+    float n = floor(t);
+    return ldexp(interpolate(exp2Table, 32, (t - n) * 32), (int)n);
+}
+
+float tableLog(float x) {
+    if (x <= 0.0f) return (x == 0.0f) ? -INFINITY : NAN;
+    // x = m * 2^e, with 0.5 <= m < 1
+    int e;
+    float m = frexp(x, &e);
+    return ((e - 1) + interpolate(log2Table, 32, (2.0f * m - 1.0f) * 32)) * MATH_LN2;
+}
+
+/* **************************************************************************
+ * POLYNOMIAL KERNELS
+ * **************************************************************************/
+
+// The coefficients and range reductions are those of the Cephes sinf, cosf,
+// atanf, expf and logf.
+
+// sin and cos for x in [-PI/4, PI/4]
+static float sinKernel(float x) {
+    float z = x * x;
+    return ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * x + x;
+}
+
+static float cosKernel(float x) {
+    float z = x * x;
+    return ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z + 1.0f;
+}
+
+// reduce x to r + q * PI/2 with r in [-PI/4, PI/4]. PI/2 is subtracted in
+// three parts so that r stays accurate for large x.
+static float reduceQuadrant(float x, int *quadrant) {
+    float q = floor(x * MATH_TWO_OVER_PI + 0.5f);
+    *quadrant = (int)(q - 4.0f * floor(q * 0.25f));
+    return ((x - q * 1.5703125f) - q * 4.837512969970703125e-4f) - q * 7.54978995489188216e-8f;
+}
+
+static float sinQuadrant(float r, int quadrant) {
+    float s = (quadrant & 1) ? cosKernel(r) : sinKernel(r);
+    return (quadrant & 2) ? -s : s;
+}
+
+float polySin(float x) {
+    int quadrant;
+    float r = reduceQuadrant(x, &quadrant);
+    return sinQuadrant(r, quadrant);
+}
+
+float polyCos(float x) {
+    int quadrant;
+    float r = reduceQuadrant(x, &quadrant);
+    return sinQuadrant(r, (quadrant + 1) & 3);
+}
+
+float polyAtan(float x) {
+    float a = fabs(x);
+    float y = 0.0f;
+    if (a > 2.414213562373095f) {
+        y = MATH_HALF_PI;
+        a = -1.0f / a;
+    }
+    else if (a > 0.4142135623730950f) {
+        y = MATH_QUARTER_PI;
+        a = (a - 1.0f) / (a + 1.0f);
+    }
+    float z = a * a;
+    y += (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * a + a;
+    return (x < 0.0f) ? -y : y;
+}
+
+float polyExp(float x) {
+    if (x > 88.7228f) return INFINITY;
+    if (x < -87.3365f) return 0.0f;
+    // e^x = 2^n * e^r, with ln 2 subtracted in two parts
+    float n = floor(x * MATH_LOG2E + 0.5f);
+    x = (x - n * 0.693359375f) + n * 2.12194440e-4f;
+    float z = x * x;
+    float y = (((((1.9875691500e-4f * x + 1.3981999507e-3f) * x + 8.3334519073e-3f) * x
+                + 4.1665795894e-2f) * x + 1.6666665459e-1f) * x + 5.0000001201e-1f) * z + x + 1.0f;
+    return ldexp(y, (int)n);
+}
+
+float polyLog(float x) {
+    if (x <= 0.0f) return (x == 0.0f) ? -INFINITY : NAN;
+    // x = m * 2^e, then centre m on 1
+    int e;
+    x = frexp(x, &e);
+    if (x < 0.707106781186547524f) {
+        e--;
+        x = x + x - 1.0f;
+    }
+    else
+        x = x - 1.0f;
+    float z = x * x;
+    float y = ((((((((7.0376836292e-2f * x - 1.1514610310e-1f) * x + 1.1676998740e-1f) * x
+                - 1.2420140846e-1f) * x + 1.4249322787e-1f) * x - 1.6668057665e-1f) * x
+                + 2.0000714765e-1f) * x - 2.4999993993e-1f) * x + 3.3333331174e-1f) * x * z;
+    y += -2.12194440e-4f * e;
+    y += -0.5f * z;
+    return x + y + 0.693359375f * e;
+}
@@ -0,0 +1,46 @@
+#ifndef _FASTMATH_H_
+#define _FASTMATH_H_
+#include "config.h"
+#include <math.h>
+
+// Kernels for the SIN, COS, ATN, EXP and LOG functions. MATH_PRECISION in
+// config.h picks the ones BASIC uses on AVR:
+//   0 - avr-libc
+//   1 - PROGMEM tables with linear interpolation, about 4 significant digits
+//   2 - polynomials, good to within a few units in the last place of a float
+// Other targets always use libm. extras/mathbench.cpp compares the kernels
+// with libm on a PC.
+
+float tableSin(float x);
+float tableCos(float x);
+float tableAtan(float x);
+float tableExp(float x);
+float tableLog(float x);
+
+float polySin(float x);
+float polyCos(float x);
+float polyAtan(float x);
+float polyExp(float x);
+float polyLog(float x);
+
+#if defined(__AVR__) && MATH_PRECISION == 1
+#define mathSin     tableSin
+#define mathCos     tableCos
+#define mathAtan    tableAtan
+#define mathExp     tableExp
+#define mathLog     tableLog
+#elif defined(__AVR__) && MATH_PRECISION == 2
+#define mathSin     polySin
+#define mathCos     polyCos
+#define mathAtan    polyAtan
+#define mathExp     polyExp
+#define mathLog     polyLog
+#else
+#define mathSin(x)  ((float)sin(x))
+#define mathCos(x)  ((float)cos(x))
+#define mathAtan(x) ((float)atan(x))
+#define mathExp(x)  ((float)exp(x))
+#define mathLog(x)  ((float)log(x))
+#endif
+
+#endif /* _FASTMATH_H_ */
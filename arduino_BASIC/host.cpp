@@ -87,6 +87,11 @@ void host_sleep(long ms)
     delay(ms);
 }
 
+unsigned long host_millis()
+{
+    return millis();
+}
+
 void host_digitalWrite(int pin,int state)
 {
     digitalWrite(pin, state ? HIGH : LOW);
@@ -107,6 +112,292 @@ void host_pinMode(int pin,int mode)
     pinMode(pin, mode);
 }
 
+// Pin change interrupts put the watched edges into pinEventBuf, and
+// host_getPinEvent() takes them out between BASIC statements. The interrupt
+// is the only writer of pinEventHead and host_getPinEvent() the only writer
+// of pinEventTail, so no locking is needed. An edge that finds the queue full
+// is counted against its pin instead.
+#define PIN_EVENT_QUEUE         16      // power of 2
+
+struct PinWatch {
+    uint8_t pin;
+    uint8_t mode;                       // PIN_EVENT_OFF = slot free
+    uint8_t mask;
+    uint8_t level;                      // at the last interrupt
+    volatile uint8_t *input;
+    unsigned int dropped;
+};
+
+static PinWatch pinWatch[PIN_EVENT_SLOTS];
+static volatile uint8_t pinEventBuf[PIN_EVENT_QUEUE];
+static volatile uint8_t pinEventHead = 0, pinEventTail = 0;
+
+// any pin change interrupt: check each watched pin for an edge
+static void pinChanged()
+{
+    for (int i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        PinWatch *w = &pinWatch[i];
+        if (w->mode == PIN_EVENT_OFF)
+            continue;
+        uint8_t level = (*w->input & w->mask) ? 1 : 0;
+        if (level == w->level)
+            continue;
+        w->level = level;
+        if (!(w->mode & (level ? PIN_EVENT_RISING : PIN_EVENT_FALLING)))
+            continue;
+        if ((uint8_t)(pinEventHead - pinEventTail) < PIN_EVENT_QUEUE)
+        {
+            pinEventBuf[pinEventHead & (PIN_EVENT_QUEUE - 1)] = w->pin;
+            pinEventHead++;
+        }
+        else
+            w->dropped++;
+    }
+}
+
+ISR(PCINT0_vect)
+{
+    pinChanged();
+}
+#ifdef PCINT1_vect
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#ifdef PCINT2_vect
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#ifdef PCINT3_vect
+ISR(PCINT3_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+
+// Starts (or with PIN_EVENT_OFF stops) queueing the given edges on pin.
+// Fails if the pin has no pin change interrupt or all the slots are in use.
+bool host_watchPin(int pin, int mode)
+{
+    volatile uint8_t *pcicr = digitalPinToPCICR(pin);
+    if (!pcicr)
+        return false;
+
+    PinWatch *w = 0;
+    for (int i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (pinWatch[i].mode != PIN_EVENT_OFF && pinWatch[i].pin == pin)
+        {
+            w = &pinWatch[i];
+            break;
+        }
+        if (!w && pinWatch[i].mode == PIN_EVENT_OFF)
+            w = &pinWatch[i];
+    }
+    if (!w)
+        return mode == PIN_EVENT_OFF;
+
+    volatile uint8_t *pcmsk = digitalPinToPCMSK(pin);
+    noInterrupts();
+    if (mode == PIN_EVENT_OFF)
+    {
+        *pcmsk &= ~_BV(digitalPinToPCMSKbit(pin));
+    }
+    else
+    {
+        if (w->mode == PIN_EVENT_OFF)
+        {
+            w->pin = pin;
+            w->input = portInputRegister(digitalPinToPort(pin));
+            w->mask = digitalPinToBitMask(pin);
+            w->level = (*w->input & w->mask) ? 1 : 0;
+            w->dropped = 0;
+        }
+        *pcmsk |= _BV(digitalPinToPCMSKbit(pin));
+        *pcicr |= _BV(digitalPinToPCICRbit(pin));
+    }
+    w->mode = mode;
+    interrupts();
+    return true;
+}
+
+// The next queued pin event, or -1 if there isn't one
+int host_getPinEvent()
+{
+    if (pinEventHead == pinEventTail)
+        return -1;
+    int pin = pinEventBuf[pinEventTail & (PIN_EVENT_QUEUE - 1)];
+    pinEventTail++;
+    return pin;
+}
+
+// Edges lost on a watched pin because the queue was full
+unsigned int host_pinEventsDropped(int pin)
+{
+    unsigned int dropped = 0;
+    noInterrupts();
+    for (int i = 0; i < PIN_EVENT_SLOTS; i++)
+    {
+        if (pinWatch[i].mode != PIN_EVENT_OFF && pinWatch[i].pin == pin)
+            dropped = pinWatch[i].dropped;
+    }
+    interrupts();
+    return dropped;
+}
+
+// SAMPLE: Timer2 interrupts at the sample rate, takes the reading started
+// the time before and starts the next, so the readings are evenly spaced
+// whatever the interrupt latency. They wait in sampleBuf, a ring like
+// pinEventBuf, until host_getSample() takes them.
+#define SAMPLE_QUEUE            32      // power of 2
+#define SAMPLE_RATE_MAX         9000    // a conversion takes 104us
+
+static volatile uint16_t sampleBuf[SAMPLE_QUEUE];
+static volatile uint8_t sampleHead = 0, sampleTail = 0;
+static volatile bool sampleConverting = false, sampleLost = false;
+
+ISR(TIMER2_COMPA_vect)
+{
+    if (sampleConverting)
+    {
+        if ((uint8_t)(sampleHead - sampleTail) < SAMPLE_QUEUE)
+        {
+            sampleBuf[sampleHead & (SAMPLE_QUEUE - 1)] = ADC;
+            sampleHead++;
+        }
+        else
+            sampleLost = true;
+    }
+    ADCSRA |= _BV(ADSC);
+    sampleConverting = true;
+}
+
+// Starts reading analog pin (0-7 or A0-A7) rate times a second. Fails if
+// the pin or rate can't be done.
+bool host_startSampling(int pin, unsigned long rate)
+{
+    static const uint16_t prescalers[] = { 1, 8, 32, 64, 128, 256, 1024 };
+    if (pin >= A0)
+        pin -= A0;
+    if (pin < 0 || pin > 7 || rate < 1 || rate > SAMPLE_RATE_MAX)
+        return false;
+    uint8_t cs;
+    unsigned long top = 0;
+    for (cs = 0; cs < 7; cs++)
+    {
+        top = F_CPU / ((unsigned long)prescalers[cs] * rate);
+        if (top <= 256)
+            break;
+    }
+    if (cs == 7)
+        return false;	// too slow for Timer2
+
+    host_stopSampling();
+    sampleHead = sampleTail = 0;
+    sampleConverting = sampleLost = false;
+    ADMUX = _BV(REFS0) | pin;	// AVcc reference, as analogRead()
+    TCCR2A = _BV(WGM21);	// CTC
+    TCNT2 = 0;
+    OCR2A = top - 1;
+    TIFR2 = _BV(OCF2A);
+    TIMSK2 = _BV(OCIE2A);
+    TCCR2B = cs + 1;	// start the clock
+    return true;
+}
+
+void host_stopSampling()
+{
+    TCCR2B = 0;
+    TIMSK2 = 0;
+    while (ADCSRA & _BV(ADSC))
+        ;	// let a conversion finish before analogRead() uses the ADC
+    sampleConverting = false;
+}
+
+// The next reading, or -1 if there isn't one yet
+int host_getSample()
+{
+    if (sampleHead == sampleTail)
+        return -1;
+    int reading = sampleBuf[sampleTail & (SAMPLE_QUEUE - 1)];
+    sampleTail++;
+    return reading;
+}
+
+// Readings were lost because the queue was full
+bool host_samplesLost()
+{
+    return sampleLost;
+}
+
+// Ports are numbered as in the Arduino core (2 = PORTB, 3 = PORTC, 4 =
+// PORTD on an UNO), and only ports with some pin on the board are valid.
+static bool validPort(int port)
+{
+    for (int pin = 0; pin < NUM_DIGITAL_PINS; pin++)
+    {
+        if (digitalPinToPort(pin) == port)
+            return true;
+    }
+    return false;
+}
+
+// The pins of port in mask take their bits from value, all at once
+bool host_portOut(int port, int mask, int value)
+{
+    if (!validPort(port))
+        return false;
+    volatile uint8_t *out = portOutputRegister(port);
+    uint8_t oldSREG = SREG;
+    cli();
+    *out = (*out & ~mask) | (value & mask);
+    SREG = oldSREG;
+    return true;
+}
+
+// All the pins of port as bits, or -1 if there is no such port
+int host_portIn(int port)
+{
+    if (!validPort(port))
+        return -1;
+    return *portInputRegister(port);
+}
+
+// Clocks out count bytes as shiftOut() would, but from the port registers
+// rather than a digitalWrite() per bit
+bool host_shiftOut(int dataPin, int clockPin, int bitOrder, float *values, int count)
+{
+    if (dataPin < 0 || dataPin >= NUM_DIGITAL_PINS || clockPin < 0 || clockPin >= NUM_DIGITAL_PINS)
+        return false;
+    volatile uint8_t *dataOut = portOutputRegister(digitalPinToPort(dataPin));
+    volatile uint8_t *clockOut = portOutputRegister(digitalPinToPort(clockPin));
+    uint8_t dataMask = digitalPinToBitMask(dataPin);
+    uint8_t clockMask = digitalPinToBitMask(clockPin);
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t val = (uint8_t)(int)values[i];
+        uint8_t oldSREG = SREG;
+        cli();
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            uint8_t high;
+            if (bitOrder == LSBFIRST)
+            {
+                high = val & 1;
+                val >>= 1;
+            }
+            else
+            {
+                high = val & 0x80;
+                val <<= 1;
+            }
+            if (high)
+                *dataOut |= dataMask;
+            else
+                *dataOut &= ~dataMask;
+            *clockOut |= clockMask;
+            *clockOut &= ~clockMask;
+        }
+        SREG = oldSREG;
+    }
+    return true;
+}
+
 #ifdef BUZZER_IN_USE
 void host_click()
 {
@@ -255,64 +546,250 @@ void host_outputChar(char c)
 }
 
 
-int host_outputInt(long num)
+// Writes the digits of n backwards from end, returns the first digit
+static char *uintToStr(unsigned long n, char *end)
 {
-    // Returns len
-    long i = num, xx = 1;
-    int c = 0;
+    // 32 bit division is slow on AVR, so switch to 16 bits when we can
+    while (n > 0xFFFF)
+    {
+        *--end = (char)(n % 10) + '0';
+        n /= 10;
+    }
+    unsigned int i = (unsigned int)n;
     do {
-        c++;
-        xx *= 10;
+        *--end = (char)(i % 10) + '0';
         i /= 10;
-    } 
+    }
     while (i);
+    return end;
+}
+
+int host_outputInt(long num)
+{
+    // Returns len
+    char buf[12];
+    char *p = uintToStr(num < 0 ? -(unsigned long)num : num, buf + sizeof(buf) - 1);
+    if (num < 0)
+        *--p = '-';
+    buf[sizeof(buf) - 1] = 0;
+    host_outputString(p);
+    return buf + sizeof(buf) - 1 - p;
+}
 
-    for (int i = 0; i < c; i++)
+// 10^r and 10^16j as 32 bit significands, see pow10Significand()
+const uint32_t pow10Small[16] PROGMEM = {
+    0x80000000, 0xA0000000, 0xC8000000, 0xFA000000, 0x9C400000, 0xC3500000, 0xF4240000, 0x98968000,
+    0xBEBC2000, 0xEE6B2800, 0x9502F900, 0xBA43B740, 0xE8D4A510, 0x9184E72A, 0xB5E620F4, 0xE35FA932
+};
+const uint32_t pow10Big[8] PROGMEM = {
+    0xA87FEA28, 0xBB127C54, 0xCFB11EAD, 0xE69594BF, 0x80000000, 0x8E1BC9BF, 0x9DC5ADA8, 0xAF298D05
+};
+
+// 10^s ~= significand * 2^exp2, with the significand in [2^31, 2^32).
+// Exact for 0 <= s <= 13, otherwise within a unit in the last place.
+// Good for -64 <= s < 64.
+static uint32_t pow10Significand(int s, int *exp2)
+{
+    int j = (s + 64) / 16 - 4;
+    uint32_t p = pgm_read_dword(&pow10Small[s - 16 * j]);
+    if (j)
     {
-        xx /= 10;
-        char digit = ((num/xx) % 10) + '0';
-        host_outputChar(digit);
+        uint64_t prod = (uint64_t)p * pgm_read_dword(&pow10Big[j + 4]);
+        p = (prod >> 63) ? (prod + 0x80000000UL) >> 32 : (prod + 0x40000000UL) >> 31;
     }
-    
-    return c;
+    // floor(s * log2(10))
+    *exp2 = (int)(((long)s * 217706L) >> 16) - 31;
+    return p;
 }
 
+// m * 10^s rounded to an integer, for m * 2^e2 * 10^s < 2^31
+static uint32_t roundScaled(uint32_t m, int e2, int s)
+{
+    int pe;
+    uint64_t prod = (uint64_t)m * pow10Significand(s, &pe);
+    int shift = -(e2 + pe);
+    return (uint32_t)(((prod >> (shift - 1)) + 1) >> 1);
+}
+
+// Formats f with up to 7 significant digits, trailing zeros removed. Numbers
+// from 0.0001 to 9999999 are printed in full, others as e.g. -1.234567e-12,
+// so buf needs 14 characters. The digits come from the bits of the float
+// using integer arithmetic rather than float divisions, so the last one is
+// within one unit of the correctly rounded digit, and only off at all when
+// the value is very nearly halfway between two.
 char *host_floatToStr(float f, char *buf)
 {
-    // Floats have approx 7 sig figs
-    float a = fabs(f);
-    if (f == 0.0f)
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    int e2 = (bits >> 23) & 0xFF;
+    uint32_t m = bits & 0x7FFFFF;
+    char *p = buf;
+
+    if (e2 == 0 && m == 0)
     {
-        buf[0] = '0'; 
-        buf[1] = 0;
+        strcpy(buf, "0");
+        return buf;
     }
-    else if (a<0.0001 || a>1000000)
+    if (bits & 0x80000000UL)
+        *p++ = '-';
+    if (e2 == 0xFF)
     {
-        // This will output -1.123456E99 = 13 characters max including trailing nul
-        dtostre(f, buf, 6, 0);
+        strcpy(p, m ? "nan" : "inf");
+        return buf;
     }
+    // f = m * 2^e2 with m normalised to 24 bits
+    if (e2)
+        m |= 0x800000;
     else
+        e2 = 1;
+    e2 -= 150;
+    while (!(m & 0x800000))
     {
-        int decPos = 7 - (int)(floor(log10(a))+1.0f);
-        dtostrf(f, 1, decPos, buf);
-    
-        if (decPos)
+        m <<= 1;
+        e2--;
+    }
+
+    // decimal exponent, from floor(log10(2^(e2+23))) - which can be one low
+    int exp10 = (int)(((long)(e2 + 23) * 78913L) >> 18);
+    uint32_t d = roundScaled(m, e2, 6 - exp10);
+    if (d >= 10000000UL)
+    {
+        exp10++;
+        d = roundScaled(m, e2, 6 - exp10);
+    }
+    char digits[8];
+    uintToStr(d, digits + 7);
+    int last = 6;
+    while (digits[last] == '0')
+        last--;
+
+    if (exp10 >= -4 && exp10 <= 6)
+    {
+        int i = 0;
+        if (exp10 < 0)
         {
-            // Remove trailing 0s
-            char *p = buf;
-            while (*p) p++;
-            p--;
-            while (*p == '0')
+            *p++ = '0';
+            *p++ = '.';
+            for (int z = -1; z > exp10; z--)
+                *p++ = '0';
+        }
+        else
+        {
+            while (i <= exp10)
+                *p++ = digits[i++];
+            if (i <= last)
+                *p++ = '.';
+        }
+        while (i <= last)
+            *p++ = digits[i++];
+        *p = 0;
+    }
+    else
+    {
+        *p++ = digits[0];
+        if (last)
+        {
+            *p++ = '.';
+            for (int i = 1; i <= last; i++)
+                *p++ = digits[i];
+        }
+        *p++ = 'e';
+        *p++ = exp10 < 0 ? '-' : '+';
+        if (exp10 < 0)
+            exp10 = -exp10;
+        *p++ = exp10 / 10 + '0';
+        *p++ = exp10 % 10 + '0';
+        *p = 0;
+    }
+    return buf;
+}
+
+// Reads a decimal number with optional sign, fraction and exponent, e.g.
+// -12.5e3, like strtod. Up to 9 significant digits are used, and the result
+// is within a unit in the last place - nearly always the correctly rounded
+// float. If end isn't 0 it is set to the first character after the number,
+// or to str if there wasn't one.
+float host_strToFloat(const char *str, const char **end)
+{
+    const char *p = str;
+    uint32_t m = 0;
+    int digits = 0, exp10 = 0;
+    bool neg = false, gotDigit = false;
+
+    while (isspace(*p))
+        p++;
+    if (*p == '-' || *p == '+')
+        neg = (*p++ == '-');
+    for (; isdigit(*p); p++)
+    {
+        gotDigit = true;
+        if (digits < 9)
+        {
+            m = m * 10 + (*p - '0');
+            if (m) digits++;
+        }
+        else
+            exp10++;
+    }
+    if (*p == '.')
+    {
+        for (p++; isdigit(*p); p++)
+        {
+            gotDigit = true;
+            if (digits < 9)
             {
-                *p-- = 0;
+                m = m * 10 + (*p - '0');
+                if (m) digits++;
+                exp10--;
             }
-            
-            if (*p == '.')
-                *p = 0;
-        }   
+        }
     }
-    
-    return buf;
+    if (!gotDigit)
+    {
+        if (end) *end = str;
+        return 0.0f;
+    }
+    // only take an exponent if there are digits after the e
+    if (*p == 'e' || *p == 'E')
+    {
+        const char *q = p + 1;
+        bool expNeg = false;
+        if (*q == '-' || *q == '+')
+            expNeg = (*q++ == '-');
+        if (isdigit(*q))
+        {
+            int e = 0;
+            for (; isdigit(*q); q++)
+            {
+                if (e < 1000)
+                    e = e * 10 + (*q - '0');
+            }
+            exp10 += expNeg ? -e : e;
+            p = q;
+        }
+    }
+    if (end) *end = p;
+
+    float f;
+    if (m == 0 || exp10 < -54)
+        f = 0.0f;
+    else if (exp10 > 38)
+        f = INFINITY;
+    else
+    {
+        // m * 10^exp10 = m * significand * 2^exp2, rounded to 24 bits by the
+        // conversion to float. Bits below the top 32 are kept as a sticky bit.
+        int exp2, shift = 0;
+        while (!(m & 0x80000000UL))
+        {
+            m <<= 1;
+            shift++;
+        }
+        uint64_t prod = (uint64_t)m * pow10Significand(exp10, &exp2);
+        uint32_t top = (uint32_t)(prod >> 32) | ((uint32_t)prod != 0);
+        f = ldexp((float)top, exp2 + 32 - shift);
+    }
+    return neg ? -f : f;
 }
 
 void host_outputFloat(float f)
@@ -29,12 +29,31 @@
 
 #define MAGIC_AUTORUN_NUMBER    0xFC
 
+// edges host_watchPin() queues, RISING|FALLING = CHANGE
+#define PIN_EVENT_OFF           0
+#define PIN_EVENT_RISING        1
+#define PIN_EVENT_FALLING       2
+#define PIN_EVENT_CHANGE        3
+// number of pins that can be watched at once
+#define PIN_EVENT_SLOTS         4
+
 void host_init(int buzzerPin);
 void host_sleep(long ms);
+unsigned long host_millis();
 void host_digitalWrite(int pin,int state);
 int host_digitalRead(int pin);
 int host_analogRead(int pin);
 void host_pinMode(int pin, int mode);
+bool host_watchPin(int pin, int mode);
+int host_getPinEvent();
+unsigned int host_pinEventsDropped(int pin);
+bool host_startSampling(int pin, unsigned long rate);
+void host_stopSampling();
+int host_getSample();
+bool host_samplesLost();
+bool host_portOut(int port, int mask, int value);
+int host_portIn(int port);
+bool host_shiftOut(int dataPin, int clockPin, int bitOrder, float *values, int count);
 void host_click();
 void host_startupTone();
 void host_cls();
@@ -45,6 +64,7 @@ void host_outputProgMemString(const char *str);
 void host_outputChar(char c);
 void host_outputFloat(float f);
 char *host_floatToStr(float f, char *buf);
+float host_strToFloat(const char *str, const char **end);
 int host_outputInt(long val);
 void host_newLine();
 char *host_readLine();
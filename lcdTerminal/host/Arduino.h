@@ -0,0 +1,44 @@
+/* Arduino.h - just enough of the Arduino core to build lcdTerminal on a PC
+ *
+ * See lcdsim.cpp for the implementation. The serial port is fed from a file at a
+ * simulated baud rate and time is simulated too, advanced by the LCD bus cost.
+ *
+ * lcdTerminal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+*/
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define INPUT		0
+#define OUTPUT		1
+#define LOW			0
+#define HIGH		1
+
+#define SERIAL_RX_BUFFER_SIZE	64
+
+typedef uint8_t byte;
+
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int val);
+unsigned long millis(void);
+unsigned long micros(void);
+
+class HardwareSerial
+{
+public:
+	void begin(unsigned long baud);
+	int available(void);
+	int read(void);
+	size_t write(uint8_t c);
+	size_t print(const char *s);
+	size_t println(const char *s);
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,45 @@
+/* LiquidCrystal.h - stand-in for the Arduino LiquidCrystal library
+ *
+ * Models an HD44780 module: display RAM, the address counter and its
+ * auto-increment, and the two-line address map used for 4-line modules.
+ * Every command and data write is counted, optionally traced, and charged
+ * its datasheet execution time on the simulated clock. See lcdsim.cpp.
+ *
+ * lcdTerminal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+*/
+#ifndef LIQUIDCRYSTAL_H
+#define LIQUIDCRYSTAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define lcdsim_us_clear		1520	// Clear display, return home
+#define lcdsim_us_cmd		37		// Other commands (set DDRAM address etc.)
+#define lcdsim_us_data		41		// Write data to DDRAM (37 us + 4 us address update)
+
+class LiquidCrystal
+{
+public:
+	LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7);
+
+	void begin(uint8_t cols, uint8_t rows);
+	void clear(void);
+	void home(void);
+	void setCursor(uint8_t col, uint8_t row);
+	size_t write(uint8_t ch);
+
+	/* Simulator access
+	*/
+	uint8_t ddram[0x80];
+	uint8_t addr;
+	uint8_t ncols, nrows;
+	unsigned long nclear, ncmd, ndata;
+	unsigned long busUs;
+
+	int Cell(int row, int col);
+};
+
+#endif
@@ -0,0 +1,405 @@
+/* lcdsim - run lcdTerminal on a PC against a simulated LCD module and serial port
+ *
+ * lcdTerminal is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * lcdTerminal is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DhG.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * The sketch is compiled unchanged, with Arduino.h and LiquidCrystal.h from this
+ * directory. The input file is sent to the sketch's serial port at the simulated
+ * baud rate; the host stops sending on XOFF and resumes on XON. Time only moves
+ * when a character is received, when the LCD module is busy, or when the sketch
+ * is idle waiting for input, so results are repeatable.
+ *
+ * At the end the module's display RAM is printed (not the sketch's own buffers),
+ * followed by statistics unless -s is given.
+ *
+ * Usage: lcdsim [-b baud] [-e] [-r repeat] [-s] [-t] file
+ *	-b baud   - serial speed (default 9600)
+ *	-e        - input contains C-style escapes: \e \n \r \b \f \v \t \\ \xHH
+ *	-r repeat - send the input this many times
+ *	-s        - print the screen only
+ *	-t        - trace the command stream sent to the module
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "LiquidCrystal.h"
+
+#define sim_us_rxbyte	5		// CPU time charged for each byte the sketch reads
+#define sim_us_loop		2		// ... and for each pass through loop()
+
+/* The sketch
+*/
+void setup(void);
+void loop(void);
+extern unsigned int rxHead, rxTail;
+extern unsigned long rxDropped, rxHwFull;
+extern LiquidCrystal lcd;
+
+HardwareSerial Serial;
+
+/* Simulated time and serial line
+*/
+static unsigned long long simUs;
+static unsigned long byteUs;		// Time to send one byte (10 bits)
+static unsigned char *inBuf;
+static size_t inLen, inPos;
+static unsigned long long hostNextUs;	// When the next byte will have arrived
+static int hostStopped;
+static unsigned char hwBuf[SERIAL_RX_BUFFER_SIZE];
+static unsigned hwHead, hwTail;
+static unsigned long hwLost, nXoff;
+static int trace;
+
+/* SerialDeliver() - move bytes that have arrived by now into the hardware buffer
+*/
+static void SerialDeliver(void)
+{
+	while ( inPos < inLen && !hostStopped && hostNextUs <= simUs )
+	{
+		/* Like HardwareSerial, one slot is always left empty.
+		*/
+		if ( hwHead - hwTail < SERIAL_RX_BUFFER_SIZE-1 )
+		{
+			hwBuf[hwHead % SERIAL_RX_BUFFER_SIZE] = inBuf[inPos];
+			hwHead++;
+		}
+		else
+		{
+			hwLost++;
+		}
+		inPos++;
+		hostNextUs += byteUs;
+	}
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+	(void)baud;			// The simulated speed comes from the command line.
+}
+
+int HardwareSerial::available(void)
+{
+	SerialDeliver();
+	return hwHead - hwTail;
+}
+
+int HardwareSerial::read(void)
+{
+	SerialDeliver();
+	if ( hwHead == hwTail )
+	{
+		return -1;
+	}
+	simUs += sim_us_rxbyte;
+	return hwBuf[hwTail++ % SERIAL_RX_BUFFER_SIZE];
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	if ( c == 0x13 )
+	{
+		hostStopped = 1;
+		nXoff++;
+	}
+	else
+	if ( c == 0x11 && hostStopped )
+	{
+		hostStopped = 0;
+		if ( hostNextUs < simUs + byteUs )
+		{
+			hostNextUs = simUs + byteUs;
+		}
+	}
+	return 1;
+}
+
+size_t HardwareSerial::print(const char *s)
+{
+	return strlen(s);
+}
+
+size_t HardwareSerial::println(const char *s)
+{
+	return print(s) + 2;
+}
+
+void pinMode(int pin, int mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+void digitalWrite(int pin, int val)
+{
+	(void)pin;
+	(void)val;
+}
+
+unsigned long millis(void)
+{
+	return (unsigned long)(simUs / 1000);
+}
+
+unsigned long micros(void)
+{
+	return (unsigned long)simUs;
+}
+
+/* The LCD module
+*/
+LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7)
+{
+	(void)rs; (void)enable; (void)d4; (void)d5; (void)d6; (void)d7;
+	ncols = 16;
+	nrows = 2;
+}
+
+void LiquidCrystal::begin(uint8_t cols, uint8_t rows)
+{
+	ncols = cols;
+	nrows = rows;
+	nclear = ncmd = ndata = 0;
+	busUs = 0;
+	clear();
+}
+
+void LiquidCrystal::clear(void)
+{
+	memset(ddram, ' ', sizeof(ddram));
+	addr = 0;
+	nclear++;
+	busUs += lcdsim_us_clear;
+	simUs += lcdsim_us_clear;
+	if ( trace )
+	{
+		printf("%10llu clear\n", simUs);
+	}
+}
+
+void LiquidCrystal::home(void)
+{
+	addr = 0;
+	ncmd++;
+	busUs += lcdsim_us_clear;
+	simUs += lcdsim_us_clear;
+	if ( trace )
+	{
+		printf("%10llu home\n", simUs);
+	}
+}
+
+void LiquidCrystal::setCursor(uint8_t col, uint8_t row)
+{
+	const uint8_t offsets[4] = { 0x00, 0x40, (uint8_t)(0x00 + ncols), (uint8_t)(0x40 + ncols) };
+
+	if ( row >= 4 )			row = 3;
+	if ( row >= nrows )		row = nrows - 1;
+
+	addr = (col + offsets[row]) & 0x7f;
+	ncmd++;
+	busUs += lcdsim_us_cmd;
+	simUs += lcdsim_us_cmd;
+	if ( trace )
+	{
+		printf("%10llu goto %d,%d (0x%02x)\n", simUs, row, col, addr);
+	}
+}
+
+size_t LiquidCrystal::write(uint8_t ch)
+{
+	ddram[addr] = ch;
+
+	/* In two-line mode the address counter runs 0x00..0x27, 0x40..0x67 and round again.
+	*/
+	addr++;
+	if ( addr == 0x28 )		addr = 0x40;
+	if ( addr == 0x68 )		addr = 0x00;
+
+	ndata++;
+	busUs += lcdsim_us_data;
+	simUs += lcdsim_us_data;
+	if ( trace )
+	{
+		printf("%10llu data '%c'\n", simUs, (ch >= ' ' && ch < 0x7f) ? ch : '?');
+	}
+	return 1;
+}
+
+int LiquidCrystal::Cell(int row, int col)
+{
+	const int offsets[4] = { 0x00, 0x40, 0x00 + ncols, 0x40 + ncols };
+	return ddram[offsets[row] + col];
+}
+
+/* Unescape() - decode C-style escapes in place. Returns the new length.
+*/
+static size_t Unescape(unsigned char *b, size_t n)
+{
+	size_t i, o = 0;
+
+	for ( i = 0; i < n; i++ )
+	{
+		if ( b[i] != '\\' || i+1 >= n )
+		{
+			b[o++] = b[i];
+			continue;
+		}
+
+		i++;
+		switch ( b[i] )
+		{
+		case 'e':	b[o++] = 0x1b;	break;
+		case 'n':	b[o++] = '\n';	break;
+		case 'r':	b[o++] = '\r';	break;
+		case 'b':	b[o++] = '\b';	break;
+		case 'f':	b[o++] = '\f';	break;
+		case 'v':	b[o++] = '\v';	break;
+		case 't':	b[o++] = '\t';	break;
+		case '\n':	break;			// Escaped newline: line continuation in the corpus file
+		case 'x':
+			{
+				unsigned v = 0;
+				int d;
+				for ( d = 0; d < 2 && i+1 < n && strchr("0123456789abcdefABCDEF", b[i+1]) && b[i+1]; d++ )
+				{
+					i++;
+					v = v * 16 + (b[i] <= '9' ? b[i] - '0' : (b[i] | 0x20) - 'a' + 10);
+				}
+				b[o++] = v;
+			}
+			break;
+		default:	b[o++] = b[i];	break;
+		}
+	}
+	return o;
+}
+
+static void Usage(void)
+{
+	fprintf(stderr, "Usage: lcdsim [-b baud] [-e] [-r repeat] [-s] [-t] file\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long baud = 9600;
+	int escapes = 0, screenOnly = 0, repeat = 1;
+	int opt, r, c, i;
+	FILE *f;
+	unsigned char *file;
+	size_t flen;
+	unsigned long long startUs;
+
+	while ( (opt = getopt(argc, argv, "b:er:st")) != -1 )
+	{
+		switch ( opt )
+		{
+		case 'b':	baud = strtoul(optarg, NULL, 0);	break;
+		case 'e':	escapes = 1;						break;
+		case 'r':	repeat = atoi(optarg);				break;
+		case 's':	screenOnly = 1;						break;
+		case 't':	trace = 1;							break;
+		default:	Usage();
+		}
+	}
+	if ( optind != argc-1 || baud == 0 || repeat < 1 )
+	{
+		Usage();
+	}
+
+	f = fopen(argv[optind], "rb");
+	if ( f == NULL )
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	fseek(f, 0, SEEK_END);
+	flen = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	file = (unsigned char *)malloc(flen + 1);
+	if ( fread(file, 1, flen, f) != flen )
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+	fclose(f);
+	if ( escapes )
+	{
+		flen = Unescape(file, flen);
+	}
+
+	inLen = flen * repeat;
+	inBuf = (unsigned char *)malloc(inLen + 1);
+	for ( i = 0; i < repeat; i++ )
+	{
+		memcpy(inBuf + i*flen, file, flen);
+	}
+	byteUs = 10000000UL / baud;
+
+	setup();
+
+	/* Only count what the input costs, not start-up.
+	*/
+	lcd.nclear = lcd.ncmd = lcd.ndata = 0;
+	lcd.busUs = 0;
+	startUs = simUs;
+	hostNextUs = simUs + byteUs;
+
+	while ( inPos < inLen || hwHead != hwTail || rxHead != rxTail )
+	{
+		unsigned long long before = simUs;
+
+		loop();
+		simUs += sim_us_loop;
+
+		/* Nothing happened: skip ahead to the next byte.
+		*/
+		if ( simUs == before + sim_us_loop && hwHead == hwTail && rxHead == rxTail
+				&& !hostStopped && hostNextUs > simUs )
+		{
+			simUs = hostNextUs;
+		}
+	}
+	loop();			// Final flush
+
+	for ( r = 0; r < lcd.nrows; r++ )
+	{
+		putchar('|');
+		for ( c = 0; c < lcd.ncols; c++ )
+		{
+			int ch = lcd.Cell(r, c);
+			putchar((ch >= ' ' && ch < 0x7f) ? ch : '?');
+		}
+		puts("|");
+	}
+
+	if ( !screenOnly )
+	{
+		printf("input bytes       %lu\n", (unsigned long)inLen);
+		printf("elapsed           %.3f ms (line time %.3f ms)\n",
+				(simUs - startUs) / 1000.0, inLen * (double)byteUs / 1000.0);
+		printf("lcd clears        %lu\n", lcd.nclear);
+		printf("lcd commands      %lu\n", lcd.ncmd);
+		printf("lcd data writes   %lu\n", lcd.ndata);
+		printf("lcd bus time      %.3f ms\n", lcd.busUs / 1000.0);
+		printf("bus us per byte   %.2f\n", inLen ? (double)lcd.busUs / inLen : 0.0);
+		printf("xoff sent         %lu\n", nXoff);
+		printf("lost (hardware)   %lu\n", hwLost);
+		printf("rxDropped         %lu\n", rxDropped);
+		printf("rxHwFull          %lu\n", rxHwFull);
+	}
+
+	return hwLost != 0 || rxDropped != 0;
+}
@@ -41,6 +41,12 @@
  *	VT - cursor up one row, with scrolling
  *	BS - cursor one column to left (unless already at left side)
  *
+ *	ESC D    - index: same as LF
+ *	ESC M    - reverse index: same as VT
+ *	ESC E    - next line: CR + LF
+ *	ESC 7    - save cursor position
+ *	ESC 8    - restore cursor position
+ *
  *	ESC[r;cH - cursor to row r, column c
  *	ESC[rA   - cursor up r rows
  *	ESC[rB   - cursor down r rows
@@ -53,12 +59,49 @@
  *	ESC[0K   - clear to right of cursor (including cursor column)
  *	ESC[1K   - clear to left of cursor (not including cursor column. Xterm might be different)
  *	ESC[2K   - clear line
+ *	ESC[nL   - insert n blank lines at the cursor line, pushing lines below down
+ *	ESC[nM   - delete n lines from the cursor line, pulling lines below up
+ *	ESC[n@   - insert n blank characters at the cursor, pushing the rest of the line right
+ *	ESC[nP   - delete n characters at the cursor, pulling the rest of the line left
+ *	ESC[t;br - set the scrolling region to rows t..b and home the cursor (default whole screen)
+ *	ESC[s    - save cursor position
+ *	ESC[u    - restore cursor position
+ *	ESC[...m - select graphic rendition: accepted and ignored (the module has no attributes)
+ *	ESC[?... - DEC private modes: accepted and ignored
+ *
+ *	LF, VT, IL and DL only scroll lines inside the scrolling region. LF on the bottom
+ *	line of the region scrolls the region up; VT on its top line scrolls it down.
+ *	IL and DL are ignored when the cursor is outside the region and leave the cursor
+ *	in the left column.
  *
- *	The c and r parameters above are strings of ascii numerals. If empty, default to 1.
+ *	The c, r, n, t and b parameters above are strings of ascii numerals. If empty, default to 1.
  *  Ranges: 1 <= r <= lcd_nrows and 1 <= c <= lcd_ncols+1
  *  ncols+1 is logically 1 character off screen to the right, which is where the
  *  cursor ends up if lcd_ncols (or more) printing characters are sent.
  *  Out of range values are coerced into range
+ *
+ * Display updates:
+ *	The LCD module is slow (~40 us per character or command, ~1.5 ms for a clear) so
+ *	a shadow copy of what the module is showing is kept in lcdShadow[]. Characters are
+ *	only sent to the module when they differ from the shadow, and the module's address
+ *	counter is only moved when the next write isn't where the module expects it.
+ *	The module's cursor isn't displayed, so cursor movements themselves cost nothing.
+ *	Scrolling rotates the lcdRows[] pointers and rewrites only the cells that change.
+ *
+ *	Incoming characters only update the buffers and mark rows dirty. The module is
+ *	brought up to date by LcdFlush() once all pending input has been processed, so a
+ *	burst of text that scrolls several times costs one repaint of the changed cells.
+ *
+ * Serial input:
+ *	HardwareSerial only buffers 64 bytes, which is about 65 ms at 9600 baud, and owns
+ *	the USART receive interrupt. Received bytes are moved from its buffer into a larger
+ *	ring (rxBuf[]) by RxPump(), which is called from loop() and between every write to
+ *	the LCD module so that a long repaint can't let the hardware buffer overflow.
+ *	When the ring passes rx_highwater the host is asked to stop with XOFF (and RTS is
+ *	de-asserted if rx_rtspin is configured); when it drains below rx_lowwater the host
+ *	is told to resume with XON.
+ *	rxDropped counts bytes lost because the ring was full and rxHwFull counts the times
+ *	the hardware buffer was found full (bytes may have been lost before they got here).
 */
 #include <LiquidCrystal.h>
 
@@ -78,6 +121,21 @@
 #define NUL '\0'
 
 #define ctrlseq_nfields	2		// Max. no of numeric fields (separated by ';') in a control sequence
+#define ctrlseq_maxlen	16		// Fields beyond ctrlseq_nfields (e.g. SGR lists) are skipped up to here
+
+#define rx_bufsize		256		// Size of the receive ring. Must be a power of 2
+#define rx_highwater	192		// Send XOFF when this many bytes are waiting ...
+#define rx_lowwater		64		// ... and XON when it drops to this many.
+#define rx_xonxoff		1		// Send XON/XOFF for flow control
+#define rx_rtspin		(-1)	// Pin for RTS flow control (low = ready), or -1 for none
+#define XON				0x11
+#define XOFF			0x13
+
+#ifndef SERIAL_RX_BUFFER_SIZE
+#define SERIAL_RX_BUFFER_SIZE	64	// HardwareSerial's buffer (older cores don't define it)
+#endif
+
+#define lcd_clear_cost	8		// lcd.clear() takes about as long as writing this many characters
 
 const int rs = 12, en = 11, d4 = 5, d5 = 4, d6 = 3, d7 = 2;
 LiquidCrystal lcd(rs, en, d4, d5, d6, d7);
@@ -93,14 +151,50 @@ char *lcdRows[lcd_nrows];
 char lcdBuf[lcd_nrows*lcd_ncols];
 int row, col;
 
+/* What the LCD module is actually showing, by physical row, and where its
+ * address counter points.
+*/
+char lcdShadow[lcd_nrows][lcd_ncols];
+int lcdAddrRow, lcdAddrCol;
+
+/* Rows of lcdRows[] that differ from the module, and whether the screen was cleared
+ * since the last flush.
+*/
+char lcdDirty[lcd_nrows];
+char lcdClearPending;
+
+/* Serial receive ring and flow control
+*/
+unsigned char rxBuf[rx_bufsize];
+unsigned int rxHead, rxTail;	// Free-running; the difference is the number of bytes waiting
+char rxStopped;					// We've asked the host to stop sending
+unsigned long rxDropped;		// Bytes lost because the ring was full
+unsigned long rxHwFull;			// Times the hardware buffer was found full
+
 /* Control sequence processing
 */
-int ctrlseq_p[2];
+int ctrlseq_p[ctrlseq_nfields];
 int ctrlseq_pos;
+char ctrlseq_private;	// '?' seen: a DEC private mode sequence
+
+/* Scrolling region (inclusive rows) and saved cursor position
+*/
+int scrollTop, scrollBot;
+int savedRow, savedCol;
 
 void LcdPutc(int ch);
-void LcdScrollUp(void);
-void LcdScrollDown(void);
+void LcdGoto(int c, int r);
+void LcdWriteCell(int r, int c, int ch);
+void LcdRefreshRow(int r);
+void LcdShadowClear(void);
+void LcdFlush(void);
+void RxPump(void);
+int RxGet(void);
+void RxFlow(int go);
+void LcdScrollUp(int top, int bot, int n);
+void LcdScrollDown(int top, int bot, int n);
+void LcdLineFeed(void);
+void LcdReverseLineFeed(void);
 void LcdBackspace(void);
 void LcdClearRow(int);
 void LcdHomeAndClear(void);
@@ -112,6 +206,13 @@ void LcdCtrlMoveCursorRight(void);
 void LcdCtrlMoveCursorLeft(void);
 void LcdCtrlClearLines(void);
 void LcdCtrlClearCharacters(void);
+void LcdCtrlInsertLines(void);
+void LcdCtrlDeleteLines(void);
+void LcdCtrlInsertCharacters(void);
+void LcdCtrlDeleteCharacters(void);
+void LcdCtrlSetScrollRegion(void);
+void LcdSaveCursor(void);
+void LcdRestoreCursor(void);
 
 /* setup() - standard Arduino "Init Task"
 */
@@ -124,11 +225,20 @@ void setup(void)
 	ledState = 0;
 
 	Serial.begin(9600);					// Start the serial port.
+	rxHead = rxTail = 0;				// Receive ring empty, host may send
+	rxStopped = 0;
+	rxDropped = 0;
+	rxHwFull = 0;
+#if rx_rtspin >= 0
+	pinMode(rx_rtspin, OUTPUT);
+#endif
+	RxFlow(1);
 	Serial.println("Hello world!");		// ToDo : it'll need a "who are you?" response
 
 	lcd.begin(lcd_ncols, lcd_nrows);	// Start the lcd driver
 	lcd.setCursor(0, 0);				// Cursor to top left.
 	//lcd.print("Hello world!");
+	LcdShadowClear();					// The module is blank after begin()
 
 	row = 0;							// Cursor to bottom left.
 	col = 0;
@@ -139,6 +249,10 @@ void setup(void)
 	}
 
 	ctrlseq_pos = -1;					// Initialise control sequence processing
+	scrollTop = 0;						// Scrolling region is the whole screen
+	scrollBot = lcd_nrows-1;
+	savedRow = 0;
+	savedCol = 0;
 
 	then = millis();					// Initialise the time reference.
 }
@@ -174,8 +288,12 @@ void loop(void)
 		}
 	}
 
-	ch = Serial.read();
-	if ( ch >= 0 )
+	/* Process everything that's waiting. That only touches the buffers, so it's quick.
+	 * Then bring the module up to date. Bytes arriving during the flush are picked up
+	 * by RxPump() and processed next time round.
+	*/
+	RxPump();
+	while ( (ch = RxGet()) >= 0 )
 	{
 		/* Offer the character to the control sequence processor first.
 		*/
@@ -184,6 +302,76 @@ void loop(void)
 			LcdPutc(ch);
 		}
 	}
+
+	LcdFlush();
+}
+
+/* RxPump() - move received bytes from HardwareSerial's buffer into the receive ring
+*/
+void RxPump(void)
+{
+	int n = Serial.available();
+
+	if ( n >= SERIAL_RX_BUFFER_SIZE-1 )
+	{
+		rxHwFull++;
+	}
+
+	while ( n > 0 )
+	{
+		int ch = Serial.read();
+
+		if ( (rxHead - rxTail) < rx_bufsize )
+		{
+			rxBuf[rxHead & (rx_bufsize-1)] = ch;
+			rxHead++;
+		}
+		else
+		{
+			rxDropped++;
+		}
+		n--;
+	}
+
+	if ( !rxStopped && (rxHead - rxTail) >= rx_highwater )
+	{
+		RxFlow(0);
+	}
+}
+
+/* RxGet() - take the next byte from the receive ring. Returns -1 if empty.
+*/
+int RxGet(void)
+{
+	int ch;
+
+	if ( rxHead == rxTail )
+	{
+		return -1;
+	}
+
+	ch = rxBuf[rxTail & (rx_bufsize-1)];
+	rxTail++;
+
+	if ( rxStopped && (rxHead - rxTail) <= rx_lowwater )
+	{
+		RxFlow(1);
+	}
+
+	return ch;
+}
+
+/* RxFlow() - tell the host to stop (go = 0) or resume (go = 1) sending
+*/
+void RxFlow(int go)
+{
+	rxStopped = !go;
+#if rx_xonxoff
+	Serial.write(go ? XON : XOFF);
+#endif
+#if rx_rtspin >= 0
+	digitalWrite(rx_rtspin, go ? LOW : HIGH);
+#endif
 }
 
 
@@ -193,18 +381,125 @@ void LcdHomeAndClear(void)
 {
 	int i, j;
 
-	lcd.clear();
 	for ( i=0; i<lcd_nrows; i++ )
 	{
 		for ( j=0; j<lcd_ncols; j++ )
 		{
 			lcdRows[i][j] = NUL;
 		}
+		lcdDirty[i] = 1;
 	}
+	lcdClearPending = 1;
 
 	row = 0;
 	col = 0;
-	lcd.setCursor(col, row);
+}
+
+/* LcdShadowClear() - record that the module is blank with its address counter at top left
+ *
+ * Call after anything that clears the module (begin(), clear()).
+*/
+void LcdShadowClear(void)
+{
+	int i, j;
+
+	for ( i=0; i<lcd_nrows; i++ )
+	{
+		for ( j=0; j<lcd_ncols; j++ )
+		{
+			lcdShadow[i][j] = ' ';
+		}
+	}
+
+	lcdAddrRow = 0;
+	lcdAddrCol = 0;
+}
+
+/* LcdGoto() - move the module's address counter to column c of row r, unless it's already there
+*/
+void LcdGoto(int c, int r)
+{
+	if ( r != lcdAddrRow || c != lcdAddrCol )
+	{
+		lcd.setCursor(c, r);
+		lcdAddrRow = r;
+		lcdAddrCol = c;
+	}
+}
+
+/* LcdWriteCell() - show a character in a cell of the module, unless it's already there
+ *
+ * Empty (NUL) cells are shown as spaces.
+*/
+void LcdWriteCell(int r, int c, int ch)
+{
+	if ( ch == NUL )
+	{
+		ch = ' ';
+	}
+
+	if ( lcdShadow[r][c] != (char)ch )
+	{
+		RxPump();				// Don't let the hardware buffer overflow during a long repaint.
+		LcdGoto(c, r);
+		lcd.write(ch);
+		lcdShadow[r][c] = ch;
+		lcdAddrCol++;			// The module advances its address counter after a write.
+	}
+}
+
+/* LcdRefreshRow() - bring a row of the module up to date with its buffer
+*/
+void LcdRefreshRow(int r)
+{
+	int j;
+
+	for ( j=0; j<lcd_ncols; j++ )
+	{
+		LcdWriteCell(r, j, lcdRows[r][j]);
+	}
+	lcdDirty[r] = 0;
+}
+
+/* LcdFlush() - bring the module up to date with the buffers
+ *
+ * If the screen was cleared and the module has more characters on it than it would
+ * take to blank them individually, use the module's clear command.
+*/
+void LcdFlush(void)
+{
+	int i, j, n;
+
+	if ( lcdClearPending )
+	{
+		lcdClearPending = 0;
+
+		n = 0;
+		for ( i=0; i<lcd_nrows; i++ )
+		{
+			for ( j=0; j<lcd_ncols; j++ )
+			{
+				if ( lcdShadow[i][j] != ' ' && lcdRows[i][j] == NUL )
+				{
+					n++;
+				}
+			}
+		}
+
+		if ( n > lcd_clear_cost )
+		{
+			lcd.clear();
+			LcdShadowClear();
+		}
+	}
+
+	for ( i=0; i<lcd_nrows; i++ )
+	{
+		if ( lcdDirty[i] )
+		{
+			LcdRefreshRow(i);
+		}
+	}
 }
 
 /* LcdPutc() - write a single character to buffers and to LCD module
@@ -222,68 +517,110 @@ void LcdPutc(int ch)
 		}
 #endif
 		lcdRows[row][col] = ch;
-		lcd.write(ch);
+		lcdDirty[row] = 1;
 		col++;
 	}
 	else
 	{
 		/* Ignore everything to the right of column lcd_ncols
 		*/
-    row++;
-    lcd.write(ch);
 	}
 }
 
-/* LcdScrollUp() - scroll the display up, blank line at bottom, cursor unchanged
+/* LcdScrollUp() - scroll rows top..bot up n lines, blank lines at bottom, cursor unchanged
 */
-void LcdScrollUp(void)
+void LcdScrollUp(int top, int bot, int n)
 {
-	lcd.clear();				// I hate this!
-	char *tmp = lcdRows[0];
+	char *tmp;
 	int i, j;
 
-	for ( i = 0; i < (lcd_nrows-1); i++ )
+	if ( n > bot - top + 1 )	n = bot - top + 1;
+
+	while ( n > 0 )
 	{
-		lcdRows[i] = lcdRows[i+1];
-		lcd.setCursor(0, i);
-		for ( j=0; j<lcd_ncols && lcdRows[i][j] != NUL; j++ )
+		tmp = lcdRows[top];
+
+		for ( i = top; i < bot; i++ )
 		{
-			lcd.write(lcdRows[i][j]);
+			lcdRows[i] = lcdRows[i+1];
 		}
+
+		for ( j=0; j<lcd_ncols; j++ )
+		{
+			tmp[j] = NUL;
+		}
+
+		lcdRows[bot] = tmp;
+		n--;
 	}
 
-	for ( j=0; j<lcd_ncols; j++ )
+	for ( i = top; i <= bot; i++ )
 	{
-		tmp[j] = NUL;
+		lcdDirty[i] = 1;
 	}
-
-	lcdRows[lcd_nrows-1] = tmp;
 }
 
-/* LcdScrollDown() - scroll the display down, blank line at top, cursor unchanged
+/* LcdScrollDown() - scroll rows top..bot down n lines, blank lines at top, cursor unchanged
 */
-void LcdScrollDown(void)
+void LcdScrollDown(int top, int bot, int n)
 {
-	lcd.clear();				// I hate this!
-	char *tmp = lcdRows[lcd_nrows-1];
+	char *tmp;
 	int i, j;
 
-	for ( i = (lcd_nrows-1); i > 0; i-- )
+	if ( n > bot - top + 1 )	n = bot - top + 1;
+
+	while ( n > 0 )
 	{
-		lcdRows[i] = lcdRows[i-1];
-		lcd.setCursor(0, i);
-		for ( j=0; j<lcd_ncols && lcdRows[i][j] != NUL; j++ )
+		tmp = lcdRows[bot];
+
+		for ( i = bot; i > top; i-- )
 		{
-			lcd.write(lcdRows[i][j]);
+			lcdRows[i] = lcdRows[i-1];
 		}
+
+		for ( j=0; j<lcd_ncols; j++ )
+		{
+			tmp[j] = NUL;
+		}
+
+		lcdRows[top] = tmp;
+		n--;
 	}
 
-	for ( j=0; j<lcd_ncols; j++ )
+	for ( i = top; i <= bot; i++ )
+	{
+		lcdDirty[i] = 1;
+	}
+}
+
+/* LcdLineFeed() - cursor down one row. Scroll the region up if on its bottom row.
+*/
+void LcdLineFeed(void)
+{
+	if ( row == scrollBot )
 	{
-		tmp[j] = NUL;
+		LcdScrollUp(scrollTop, scrollBot, 1);
 	}
+	else
+	if ( row < lcd_nrows-1 )
+	{
+		row++;
+	}
+}
 
-	lcdRows[0] = tmp;
+/* LcdReverseLineFeed() - cursor up one row. Scroll the region down if on its top row.
+*/
+void LcdReverseLineFeed(void)
+{
+	if ( row == scrollTop )
+	{
+		LcdScrollDown(scrollTop, scrollBot, 1);
+	}
+	else
+	if ( row > 0 )
+	{
+		row--;
+	}
 }
 
 /* LcdBackspace() - set the cursor one column to the left.
@@ -292,8 +629,6 @@ void LcdBackspace(void)
 {
 	col = col - 1;
 	if ( col < 0 )				col = 0;				// Default to first column.
-
-	lcd.setCursor(col, row);
 }
 
 /* LcdClearRow() - clear a row
@@ -306,7 +641,6 @@ void LcdClearRow(int r)
 
 	col = 0;
 	row = r;
-	lcd.setCursor(col, row);
 
 	for (i = 0; i < lcd_ncols; i++ )
 	{
@@ -342,35 +676,16 @@ int LcdCtrlSeq(int ch)
 			if ( ch == CR )
 			{
 				col = 0;
-				lcd.setCursor(col, row);
 			}
 			else
 			if ( ch == LF )
 			{
-				if ( row >= 3 )
-				{
-					row = 3;		// Defensive
-					LcdScrollUp();
-				}
-				else
-				{
-					row++;
-				}
-				lcd.setCursor(col, row);
+				LcdLineFeed();
 			}
 			else
 			if ( ch == VT )
 			{
-				if ( row <= 0 )
-				{
-					row = 0;		// Defensive
-					LcdScrollDown();
-				}
-				else
-				{
-					row--;
-				}
-				lcd.setCursor(col, row);
+				LcdReverseLineFeed();
 			}
 			else
 			if ( ch == FF )
@@ -396,6 +711,39 @@ int LcdCtrlSeq(int ch)
 			ctrlseq_pos = 1;
 			ctrlseq_p[0] = -1;
 			ctrlseq_p[1] = -1;
+			ctrlseq_private = 0;
+			eaten = 1;			// We ate the character
+		}
+		else
+		if ( ch == 'D' || ch == 'M' || ch == 'E' || ch == '7' || ch == '8' )
+		{
+			/* Two-character escape sequences.
+			*/
+			if ( ch == 'D' )
+			{
+				LcdLineFeed();
+			}
+			else
+			if ( ch == 'M' )
+			{
+				LcdReverseLineFeed();
+			}
+			else
+			if ( ch == 'E' )
+			{
+				col = 0;
+				LcdLineFeed();
+			}
+			else
+			if ( ch == '7' )
+			{
+				LcdSaveCursor();
+			}
+			else
+			{
+				LcdRestoreCursor();
+			}
+			ctrlseq_pos = -1;
 			eaten = 1;			// We ate the character
 		}
 		else
@@ -406,20 +754,23 @@ int LcdCtrlSeq(int ch)
 		}
 	}
 	else
-	if ( ctrlseq_pos <= ctrlseq_nfields )
+	if ( ctrlseq_pos <= ctrlseq_maxlen )
 	{
 		if ( ch >= '0' && ch <= '9' )
 		{
-			/* In a numeric field.
+			/* In a numeric field. Fields beyond ctrlseq_nfields are skipped.
 			*/
 			int d = ch - '0';
-			if ( ctrlseq_p[ctrlseq_pos-1] < 0 )
-			{
-				ctrlseq_p[ctrlseq_pos-1] = d;
-			}
-			else
+			if ( ctrlseq_pos <= ctrlseq_nfields )
 			{
-				ctrlseq_p[ctrlseq_pos-1] = ctrlseq_p[ctrlseq_pos-1] * 10 + d;
+				if ( ctrlseq_p[ctrlseq_pos-1] < 0 )
+				{
+					ctrlseq_p[ctrlseq_pos-1] = d;
+				}
+				else
+				{
+					ctrlseq_p[ctrlseq_pos-1] = ctrlseq_p[ctrlseq_pos-1] * 10 + d;
+				}
 			}
 		}
 		else
@@ -430,6 +781,18 @@ int LcdCtrlSeq(int ch)
 			ctrlseq_pos++;
 		}
 		else
+		if ( ch == '?' )
+		{
+			ctrlseq_private = 1;
+		}
+		else
+		if ( ctrlseq_private )
+		{
+			/* DEC private mode (e.g. ESC[?25l) - nothing to do on this display.
+			*/
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
 		if ( ch == 'H' || ch == 'f' )
 		{
 			LcdCtrlSetCursor();
@@ -472,6 +835,55 @@ int LcdCtrlSeq(int ch)
 			ctrlseq_pos = -1;		// ... and that's it
 		}
 		else
+		if ( ch == 'L' )
+		{
+			LcdCtrlInsertLines();
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
+		if ( ch == 'M' )
+		{
+			LcdCtrlDeleteLines();
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
+		if ( ch == '@' )
+		{
+			LcdCtrlInsertCharacters();
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
+		if ( ch == 'P' )
+		{
+			LcdCtrlDeleteCharacters();
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
+		if ( ch == 'r' )
+		{
+			LcdCtrlSetScrollRegion();
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
+		if ( ch == 's' )
+		{
+			LcdSaveCursor();
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
+		if ( ch == 'u' )
+		{
+			LcdRestoreCursor();
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
+		if ( ch == 'm' )
+		{
+			/* Select graphic rendition - the module has no attributes, so nothing to do.
+			*/
+			ctrlseq_pos = -1;		// ... and that's it
+		}
+		else
 		{
 			/* Unknown control sequence - just ignore it.
 			*/
@@ -499,8 +911,6 @@ void LcdCtrlSetCursor(void)
 	col = ctrlseq_p[1] - 1;
 	col = ( col < 0 ) ? 0 : col;						// Default to first column.
 	col = ( col > lcd_ncols ) ? lcd_ncols : col;		// Force to "just off screen".
-
-	lcd.setCursor(col, row);
 }
 
 /* LcdCtrlMoveCursorUp() - move the cursor r rows up.
@@ -512,8 +922,6 @@ void LcdCtrlMoveCursorUp(void)
 
 	row = row - r;
 	if ( row < 0 )	row = 0;
-
-	lcd.setCursor(col, row);
 }
 
 /* LcdCtrlMoveCursorDown() - move the cursor r rows down.
@@ -525,8 +933,6 @@ void LcdCtrlMoveCursorDown(void)
 
 	row = row + r;
 	if ( row >= lcd_nrows )		row = lcd_nrows-1;
-
-	lcd.setCursor(col, row);
 }
 
 /* LcdCtrlMoveCursorRight() - move the cursor c colums right.
@@ -538,8 +944,6 @@ void LcdCtrlMoveCursorRight(void)
 
 	col = col + c;
 	if ( col > lcd_ncols )		col = lcd_ncols;
-
-	lcd.setCursor(col, row);
 }
 
 /* LcdCtrlMoveCursorLeft() - move the cursor c colums left.
@@ -551,8 +955,6 @@ void LcdCtrlMoveCursorLeft(void)
 
 	col = col - c;
 	if ( col < 0 )		col = 0;
-
-	lcd.setCursor(col, row);
 }
 
 /* LcdCtrlClearLines() - clear lines of the display
@@ -597,7 +999,6 @@ void LcdCtrlClearLines(void)
 	*/
 	row = saverow;
 	col = savecol;
-	lcd.setCursor(col, row);
 }
 
 /* LcdCtrlClearCharacters() - clear characters from the current line.
@@ -626,7 +1027,6 @@ void LcdCtrlClearCharacters(void)
 		*/
 		count = col;
 		col = 0;
-		lcd.setCursor(col, row);
 	}
 	else
 	if ( ctrlseq_p[0] == 2 )
@@ -635,7 +1035,6 @@ void LcdCtrlClearCharacters(void)
 		*/
 		count = lcd_ncols;
 		col = 0;
-		lcd.setCursor(col, row);
 	}
 	else
 	{
@@ -651,5 +1050,127 @@ void LcdCtrlClearCharacters(void)
 	*/
 	row = saverow;
 	col = savecol;
-	lcd.setCursor(col, row);
+}
+
+/* LcdCtrlInsertLines() - insert n blank lines at the cursor line. Sequence "ESC [ n L"
+*/
+void LcdCtrlInsertLines(void)
+{
+	int n = ctrlseq_p[0];
+	if ( n <= 0 )		n = 1;
+
+	if ( row < scrollTop || row > scrollBot )
+	{
+		return;		// Outside the scrolling region - ignored.
+	}
+
+	LcdScrollDown(row, scrollBot, n);
+	col = 0;
+}
+
+/* LcdCtrlDeleteLines() - delete n lines at the cursor line. Sequence "ESC [ n M"
+*/
+void LcdCtrlDeleteLines(void)
+{
+	int n = ctrlseq_p[0];
+	if ( n <= 0 )		n = 1;
+
+	if ( row < scrollTop || row > scrollBot )
+	{
+		return;		// Outside the scrolling region - ignored.
+	}
+
+	LcdScrollUp(row, scrollBot, n);
+	col = 0;
+}
+
+/* LcdCtrlInsertCharacters() - insert n blanks at the cursor. Sequence "ESC [ n @"
+ *
+ * Characters pushed past the last column are lost. The cursor doesn't move.
+*/
+void LcdCtrlInsertCharacters(void)
+{
+	int j;
+	int n = ctrlseq_p[0];
+	if ( n <= 0 )					n = 1;
+	if ( col >= lcd_ncols )			return;
+	if ( n > lcd_ncols - col )		n = lcd_ncols - col;
+
+	for ( j = lcd_ncols-1; j >= col+n; j-- )
+	{
+		lcdRows[row][j] = lcdRows[row][j-n];
+	}
+
+	for ( j = col; j < col+n; j++ )
+	{
+		lcdRows[row][j] = NUL;
+	}
+
+	lcdDirty[row] = 1;
+}
+
+/* LcdCtrlDeleteCharacters() - delete n characters at the cursor. Sequence "ESC [ n P"
+ *
+ * Blanks are pulled in at the right. The cursor doesn't move.
+*/
+void LcdCtrlDeleteCharacters(void)
+{
+	int j;
+	int n = ctrlseq_p[0];
+	if ( n <= 0 )					n = 1;
+	if ( col >= lcd_ncols )			return;
+	if ( n > lcd_ncols - col )		n = lcd_ncols - col;
+
+	for ( j = col; j < lcd_ncols-n; j++ )
+	{
+		lcdRows[row][j] = lcdRows[row][j+n];
+	}
+
+	for ( j = lcd_ncols-n; j < lcd_ncols; j++ )
+	{
+		lcdRows[row][j] = NUL;
+	}
+
+	lcdDirty[row] = 1;
+}
+
+/* LcdCtrlSetScrollRegion() - set the scrolling region. Sequence "ESC [ top ; bottom r"
+ *
+ * Missing parameters default to the whole screen. The region must be at least two
+ * lines, otherwise the sequence is ignored. The cursor goes to top left.
+*/
+void LcdCtrlSetScrollRegion(void)
+{
+	int t = ctrlseq_p[0] - 1;
+	int b = ctrlseq_p[1] - 1;
+
+	if ( t < 0 )				t = 0;
+	if ( b < 0 )				b = lcd_nrows-1;
+	if ( b >= lcd_nrows )		b = lcd_nrows-1;
+
+	if ( t >= b )
+	{
+		return;		// Bomb out - invalid region.
+	}
+
+	scrollTop = t;
+	scrollBot = b;
+	row = 0;
+	col = 0;
+}
+
+/* LcdSaveCursor() - remember the cursor position. Sequences "ESC 7" and "ESC [ s"
+*/
+void LcdSaveCursor(void)
+{
+	savedRow = row;
+	savedCol = col;
+}
+
+/* LcdRestoreCursor() - go back to the saved cursor position. Sequences "ESC 8" and "ESC [ u"
+*/
+void LcdRestoreCursor(void)
+{
+	row = savedRow;
+	col = savedCol;
 }